@@ -0,0 +1,460 @@
+#include "ext.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACCESS_LOG_FORMAT_COMMON 0
+#define ACCESS_LOG_FORMAT_TIMED  1
+#define ACCESS_LOG_FORMAT_JSON   2
+
+#define ACCESS_LOG_WRITE_BUFFER  65536
+#define ACCESS_LOG_FLUSH_MSEC    200
+
+static VALUE t_allocate(VALUE klass);
+
+static void t_free(Libevent_AccessLog *log);
+
+static VALUE t_initialize(VALUE self, VALUE path, VALUE format);
+
+static VALUE t_reopen(VALUE self);
+
+static VALUE t_close(VALUE self);
+
+static VALUE t_get_dropped(VALUE self);
+
+static void *t_writer(void *context);
+
+static void t_stop(Libevent_AccessLog *log);
+
+static void t_destroy(Libevent_AccessLog *log);
+
+static void t_dispose(Libevent_AccessLog *log);
+
+void Init_libevent_access_log() {
+  cLibevent_AccessLog = rb_define_class_under(mLibevent, "AccessLog", rb_cObject);
+
+  rb_define_alloc_func(cLibevent_AccessLog, t_allocate);
+
+  rb_define_method(cLibevent_AccessLog, "initialize", t_initialize, 2);
+  rb_define_method(cLibevent_AccessLog, "reopen", t_reopen, 0);
+  rb_define_method(cLibevent_AccessLog, "close", t_close, 0);
+  rb_define_method(cLibevent_AccessLog, "dropped", t_get_dropped, 0);
+}
+
+/*
+ * Allocate memory
+ */
+static VALUE t_allocate(VALUE klass) {
+  Libevent_AccessLog *log;
+
+  // allocated outside of Ruby heap: last reference may be released by event loop thread without GVL
+  log = malloc(sizeof(Libevent_AccessLog));
+  if ( !log )
+    rb_memerror();
+
+  // reference of Ruby object itself
+  log->refs = 1;
+  log->path = NULL;
+  log->fd = -1;
+  log->format = ACCESS_LOG_FORMAT_TIMED;
+  log->entries = NULL;
+  log->head = 0;
+  log->tail = 0;
+  log->dropped = 0;
+  log->running = 0;
+  log->reopen = 0;
+  log->detached = 0;
+  // kept until log is freed: pushes of in-flight requests may signal writer concurrently with #close
+  pthread_mutex_init(&log->mutex, NULL);
+  pthread_cond_init(&log->cond, NULL);
+
+  return Data_Wrap_Struct(klass, 0, t_free, log);
+}
+
+/*
+ * Free memory
+ * @note writer is kept running until requests holding the log are finished,
+ *   without them queued records are flushed right away (i.e. at exit)
+ */
+static void t_free(Libevent_AccessLog *log) {
+  if ( __atomic_load_n(&log->refs, __ATOMIC_ACQUIRE) == 1 )
+    t_stop(log);
+
+  Libevent_AccessLog_release(log);
+}
+
+/*
+ * Keep access log alive while request logged to it is in flight. Thread safe.
+ */
+void Libevent_AccessLog_retain(Libevent_AccessLog *log) {
+  __atomic_add_fetch(&log->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Release access log reference, stops writer and frees log when it is the last one. Thread safe.
+ */
+void Libevent_AccessLog_release(Libevent_AccessLog *log) {
+  if ( __atomic_sub_fetch(&log->refs, 1, __ATOMIC_ACQ_REL) == 0 )
+    t_destroy(log);
+}
+
+/*
+ * Free log released by last request. Running writer is not joined as it may be
+ * called from event loop thread: writer drains ring buffer and frees log itself.
+ */
+static void t_destroy(Libevent_AccessLog *log) {
+  if ( log->running ) {
+    pthread_detach(log->writer);
+    pthread_mutex_lock(&log->mutex);
+    log->detached = 1;
+    __atomic_store_n(&log->running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    return;
+  }
+
+  t_dispose(log);
+}
+
+static void t_dispose(Libevent_AccessLog *log) {
+  if ( log->fd != -1 )
+    close(log->fd);
+  pthread_mutex_destroy(&log->mutex);
+  pthread_cond_destroy(&log->cond);
+
+  if ( log->entries )
+    free(log->entries);
+  if ( log->path )
+    free(log->path);
+
+  free(log);
+}
+
+/*
+ * Open log file and start background writer thread
+ *
+ * @note records are queued into a fixed size ring buffer by event loop thread
+ *   and written by writer thread in batches. When ring buffer is full records are
+ *   dropped rather than blocking event loop.
+ *
+ * @param [String] path log file path
+ * @param [Symbol String] format one of :common, :timed (common plus request duration) or :json
+ */
+static VALUE t_initialize(VALUE self, VALUE path, VALUE format) {
+  Libevent_AccessLog *log;
+  const char *format_name;
+
+  Data_Get_Struct(self, Libevent_AccessLog, log);
+  Check_Type(path, T_STRING);
+
+  format_name = RSTRING_PTR(rb_funcall(format, rb_intern("to_s"), 0));
+  if ( strcmp(format_name, "common") == 0 )
+    log->format = ACCESS_LOG_FORMAT_COMMON;
+  else if ( strcmp(format_name, "timed") == 0 )
+    log->format = ACCESS_LOG_FORMAT_TIMED;
+  else if ( strcmp(format_name, "json") == 0 )
+    log->format = ACCESS_LOG_FORMAT_JSON;
+  else
+    rb_raise(rb_eArgError, "unknown access log format given");
+
+  log->path = strdup(RSTRING_PTR(path));
+  log->entries = malloc(sizeof(Libevent_AccessLogEntry) * LIBEVENT_ACCESS_LOG_CAPACITY);
+  if ( !log->path || !log->entries )
+    rb_memerror();
+
+  log->fd = open(log->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if ( log->fd == -1 )
+    rb_sys_fail(log->path);
+
+  log->running = 1;
+  if ( pthread_create(&log->writer, NULL, t_writer, log) != 0 ) {
+    // writer is not started so t_stop would skip cleanup
+    log->running = 0;
+    close(log->fd);
+    log->fd = -1;
+    rb_raise(rb_eRuntimeError, "Could not start access log writer");
+  }
+
+  rb_iv_set(self, "@path", path);
+
+  return self;
+}
+
+/*
+ * Ask writer thread to reopen log file (i.e after rotation)
+ * @return [nil]
+ */
+static VALUE t_reopen(VALUE self) {
+  Libevent_AccessLog *log;
+
+  Data_Get_Struct(self, Libevent_AccessLog, log);
+  if ( !log->running )
+    return Qnil;
+
+  __atomic_store_n(&log->reopen, 1, __ATOMIC_RELEASE);
+  pthread_cond_signal(&log->cond);
+
+  return Qnil;
+}
+
+/*
+ * Flush queued records, stop writer thread and close log file
+ * @return [nil]
+ */
+static VALUE t_close(VALUE self) {
+  Libevent_AccessLog *log;
+
+  Data_Get_Struct(self, Libevent_AccessLog, log);
+  t_stop(log);
+
+  return Qnil;
+}
+
+/*
+ * Get number of records dropped because ring buffer was full
+ * @return [Fixnum]
+ */
+static VALUE t_get_dropped(VALUE self) {
+  Libevent_AccessLog *log;
+
+  Data_Get_Struct(self, Libevent_AccessLog, log);
+
+  return ULONG2NUM(__atomic_load_n(&log->dropped, __ATOMIC_RELAXED));
+}
+
+/*
+ * Queue record of completed request. Called from event loop thread only.
+ * Never blocks: record is dropped if ring buffer is full.
+ */
+void Libevent_AccessLog_push(Libevent_AccessLog *log, struct evhttp_request *ev_request, int status, size_t bytes, const struct timeval *start) {
+  Libevent_AccessLogEntry *entry;
+  const char *method;
+  const char *uri;
+  unsigned long head;
+  unsigned long tail;
+
+  // may be stopped by #close from other thread
+  if ( !__atomic_load_n(&log->running, __ATOMIC_ACQUIRE) )
+    return;
+
+  head = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+  if ( head - tail >= LIBEVENT_ACCESS_LOG_CAPACITY ) {
+    __atomic_add_fetch(&log->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  entry = &log->entries[head & (LIBEVENT_ACCESS_LOG_CAPACITY - 1)];
+
+  switch ( evhttp_request_get_command(ev_request) ) {
+    case EVHTTP_REQ_GET     : method = "GET";     break;
+    case EVHTTP_REQ_POST    : method = "POST";    break;
+    case EVHTTP_REQ_HEAD    : method = "HEAD";    break;
+    case EVHTTP_REQ_PUT     : method = "PUT";     break;
+    case EVHTTP_REQ_DELETE  : method = "DELETE";  break;
+    case EVHTTP_REQ_OPTIONS : method = "OPTIONS"; break;
+    case EVHTTP_REQ_TRACE   : method = "TRACE";   break;
+    case EVHTTP_REQ_CONNECT : method = "CONNECT"; break;
+    case EVHTTP_REQ_PATCH   : method = "PATCH";   break;
+    default: method = "-"; break;
+  }
+  uri = evhttp_request_get_uri(ev_request);
+
+  gettimeofday(&entry->time, NULL);
+  entry->duration = (entry->time.tv_sec - start->tv_sec) * 1000000L + (entry->time.tv_usec - start->tv_usec);
+  entry->status = status;
+  entry->bytes = bytes;
+  entry->major = ev_request->major;
+  entry->minor = ev_request->minor;
+  strncpy(entry->method, method, sizeof(entry->method) - 1);
+  entry->method[sizeof(entry->method) - 1] = '\0';
+  strncpy(entry->remote_host, ev_request->remote_host ? ev_request->remote_host : "-", sizeof(entry->remote_host) - 1);
+  entry->remote_host[sizeof(entry->remote_host) - 1] = '\0';
+  strncpy(entry->uri, uri ? uri : "-", sizeof(entry->uri) - 1);
+  entry->uri[sizeof(entry->uri) - 1] = '\0';
+
+  __atomic_store_n(&log->head, head + 1, __ATOMIC_RELEASE);
+
+  // wake writer early only when ring buffer becomes half full
+  if ( head + 1 - tail == LIBEVENT_ACCESS_LOG_CAPACITY / 2 )
+    pthread_cond_signal(&log->cond);
+}
+
+/*
+ * Stop writer thread and wait until it drains ring buffer.
+ * Mutex and condition are left to t_dispose as event loop may still push records.
+ */
+static void t_stop(Libevent_AccessLog *log) {
+  if ( !log->running )
+    return;
+
+  pthread_mutex_lock(&log->mutex);
+  __atomic_store_n(&log->running, 0, __ATOMIC_RELEASE);
+  pthread_cond_signal(&log->cond);
+  pthread_mutex_unlock(&log->mutex);
+
+  pthread_join(log->writer, NULL);
+
+  if ( log->fd != -1 ) {
+    close(log->fd);
+    log->fd = -1;
+  }
+}
+
+/*
+ * Write whole buffer to log file
+ */
+static void t_write(Libevent_AccessLog *log, const char *buffer, size_t length) {
+  ssize_t written;
+
+  while ( length > 0 ) {
+    written = write(log->fd, buffer, length);
+    if ( written == -1 ) {
+      if ( errno == EINTR )
+        continue;
+      return;
+    }
+    buffer += written;
+    length -= written;
+  }
+}
+
+/*
+ * Copy string into buffer escaping quotes, backslashes and control characters
+ */
+static size_t t_escape(char *buffer, size_t size, const char *string) {
+  size_t length = 0;
+
+  for ( ; *string && length + 6 < size; string++ ) {
+    unsigned char c = (unsigned char)*string;
+    if ( c == '"' || c == '\\' ) {
+      buffer[length++] = '\\';
+      buffer[length++] = c;
+    } else if ( c < 0x20 || c == 0x7f ) {
+      length += snprintf(buffer + length, size - length, "\\u%04x", c);
+    } else {
+      buffer[length++] = c;
+    }
+  }
+  buffer[length] = '\0';
+
+  return length;
+}
+
+/*
+ * Format single record into buffer
+ * @return number of bytes written
+ */
+static size_t t_format(Libevent_AccessLog *log, Libevent_AccessLogEntry *entry, char *buffer, size_t size) {
+  char timestamp[64];
+  char uri[sizeof(entry->uri) * 2];
+  struct tm tm;
+  int length;
+
+  localtime_r(&entry->time.tv_sec, &tm);
+  t_escape(uri, sizeof(uri), entry->uri);
+
+  if ( log->format == ACCESS_LOG_FORMAT_JSON ) {
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S%z", &tm);
+    length = snprintf(buffer, size,
+        "{\"time\":\"%s\",\"remote_addr\":\"%s\",\"method\":\"%s\",\"uri\":\"%s\",\"protocol\":\"HTTP/%d.%d\",\"status\":%d,\"bytes\":%lu,\"duration\":%.6f}\n",
+        timestamp, entry->remote_host, entry->method, uri, entry->major, entry->minor,
+        entry->status, (unsigned long)entry->bytes, entry->duration / 1000000.0);
+  } else {
+    strftime(timestamp, sizeof(timestamp), "%d/%b/%Y:%H:%M:%S %z", &tm);
+    length = snprintf(buffer, size, "%s - - [%s] \"%s %s HTTP/%d.%d\" %d %lu",
+        entry->remote_host, timestamp, entry->method, uri, entry->major, entry->minor,
+        entry->status, (unsigned long)entry->bytes);
+    if ( length > 0 && (size_t)length < size && log->format == ACCESS_LOG_FORMAT_TIMED )
+      length += snprintf(buffer + length, size - length, " %.6f", entry->duration / 1000000.0);
+    if ( length > 0 && (size_t)length + 1 < size )
+      buffer[length++] = '\n';
+  }
+
+  if ( length < 0 )
+    return 0;
+
+  return (size_t)length < size ? (size_t)length : size - 1;
+}
+
+/*
+ * Format and write all queued records using single write per full buffer
+ */
+static void t_drain(Libevent_AccessLog *log, char *buffer) {
+  unsigned long head;
+  unsigned long tail;
+  size_t length = 0;
+
+  head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+  tail = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+
+  for ( ; tail != head; tail++ ) {
+    if ( ACCESS_LOG_WRITE_BUFFER - length < LIBEVENT_ACCESS_LOG_URI_MAX * 3 ) {
+      t_write(log, buffer, length);
+      length = 0;
+    }
+    length += t_format(log, &log->entries[tail & (LIBEVENT_ACCESS_LOG_CAPACITY - 1)],
+        buffer + length, ACCESS_LOG_WRITE_BUFFER - length);
+    // release slot as soon as it is formatted
+    __atomic_store_n(&log->tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  if ( length > 0 )
+    t_write(log, buffer, length);
+}
+
+/*
+ * Background writer thread. Does not touch any Ruby objects.
+ */
+static void *t_writer(void *context) {
+  Libevent_AccessLog *log = (Libevent_AccessLog *)context;
+  char *buffer;
+  struct timespec deadline;
+  int detached;
+  int fd;
+
+  buffer = malloc(ACCESS_LOG_WRITE_BUFFER);
+  if ( !buffer )
+    return NULL;
+
+  for (;;) {
+    t_drain(log, buffer);
+
+    if ( __atomic_exchange_n(&log->reopen, 0, __ATOMIC_ACQ_REL) ) {
+      fd = open(log->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+      if ( fd != -1 ) {
+        close(log->fd);
+        log->fd = fd;
+      }
+    }
+
+    pthread_mutex_lock(&log->mutex);
+    if ( !__atomic_load_n(&log->running, __ATOMIC_ACQUIRE) ) {
+      detached = log->detached;
+      pthread_mutex_unlock(&log->mutex);
+      break;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += ACCESS_LOG_FLUSH_MSEC * 1000000L;
+    if ( deadline.tv_nsec >= 1000000000L ) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&log->cond, &log->mutex, &deadline);
+    pthread_mutex_unlock(&log->mutex);
+  }
+
+  // flush records queued before stop
+  t_drain(log, buffer);
+  free(buffer);
+
+  // nobody joins detached writer, last reference is already released
+  if ( detached )
+    t_dispose(log);
+
+  return NULL;
+}
@@ -2,22 +2,43 @@
 
 static VALUE t_allocate(VALUE klass);
 
+static void t_mark(Libevent_Base *base);
+
 static void t_free(Libevent_Base *base);
 
 static VALUE t_dispatch(VALUE self);
 
-static VALUE t_exit_loop(VALUE self);
+static VALUE t_run_loop(VALUE context);
+
+static VALUE t_stop_loop(VALUE context);
+
+static VALUE t_exit_loop(int argc, VALUE *argv, VALUE self);
+
+static VALUE t_graceful_exit(VALUE self, VALUE timeout);
+
+static VALUE t_get_requests(VALUE self);
 
 static VALUE t_break_loop(VALUE self);
 
+static VALUE t_configure(VALUE self, VALUE max_dispatch_callbacks);
+
+static VALUE t_init_priorities(VALUE self, VALUE priorities);
+
+static VALUE t_get_priorities(VALUE self);
+
 void Init_libevent_base() {
   cLibevent_Base = rb_define_class_under(mLibevent, "Base", rb_cObject);
   
   rb_define_alloc_func(cLibevent_Base, t_allocate);
 
   rb_define_method(cLibevent_Base, "dispatch", t_dispatch, 0);
-  rb_define_method(cLibevent_Base, "exit_loop", t_exit_loop, 0);
+  rb_define_method(cLibevent_Base, "exit_loop", t_exit_loop, -1);
+  rb_define_method(cLibevent_Base, "graceful_exit", t_graceful_exit, 1);
+  rb_define_method(cLibevent_Base, "requests", t_get_requests, 0);
   rb_define_method(cLibevent_Base, "break_loop", t_break_loop, 0);
+  rb_define_method(cLibevent_Base, "init_priorities", t_init_priorities, 1);
+  rb_define_method(cLibevent_Base, "priorities", t_get_priorities, 0);
+  rb_define_private_method(cLibevent_Base, "configure", t_configure, 1);
 }
 
 /*
@@ -28,19 +49,160 @@ static VALUE t_allocate(VALUE klass) {
 
   base = ALLOC(Libevent_Base);
   base->ev_base = event_base_new();
+  base->refs = 0;
+  base->freed = 0;
+  base->requests = 0;
+  base->draining = 0;
+  base->interrupted = 0;
+  base->error_state = 0;
+  base->error = Qnil;
+  base->thread = Qnil;
+  base->profiler = NULL;
 
   if ( !base->ev_base ) {
     rb_fatal("Couldn't get an event base");
   }
 
-  return Data_Wrap_Struct(klass, 0, t_free, base); 
+  return Data_Wrap_Struct(klass, t_mark, t_free, base); 
+}
+
+/*
+ * Mark exception raised by callback until it is re-raised by #dispatch,
+ * thread running the loop and active profiler
+ */
+static void t_mark(Libevent_Base *base) {
+  rb_gc_mark(base->error);
+  rb_gc_mark(base->thread);
+  if ( base->profiler )
+    rb_gc_mark(base->profiler->self);
 }
 
 /*
  * Free memmory
+ * @note event base is kept until objects holding its events are freed,
+ *   finalizers run in arbitrary order on exit
  */
 static void t_free(Libevent_Base *base) {
-  event_base_free(base->ev_base);
+  base->freed = 1;
+
+  if ( base->refs == 0 ) {
+    event_base_free(base->ev_base);
+    xfree(base);
+  }
+}
+
+/*
+ * Keep event base alive while object using it is alive
+ */
+void Libevent_Base_retain(Libevent_Base *base) {
+  base->refs++;
+}
+
+/*
+ * Release event base reference, frees it when base object is already collected
+ */
+void Libevent_Base_release(Libevent_Base *base) {
+  base->refs--;
+
+  if ( base->freed && base->refs == 0 ) {
+    event_base_free(base->ev_base);
+    xfree(base);
+  }
+}
+
+/*
+ * Raise if event loop is running in another thread.
+ * Loop runs without GVL and libevent objects it owns are not thread safe,
+ * so they can be used only from loop callbacks or while loop is not running.
+ * Handler threads pass replies through Http reply queue instead.
+ */
+void Libevent_Base_check_thread(Libevent_Base *base) {
+  if ( base->thread != Qnil && base->thread != rb_thread_current() )
+    rb_raise(rb_eThreadError, "event loop objects can be used only by thread running Base#dispatch");
+}
+
+typedef struct t_dispatch_args {
+  Libevent_Base *base;
+  VALUE thread;
+} t_dispatch_args;
+
+typedef struct t_with_gvl_args {
+  Libevent_Base *base;
+  const char *kind;
+  const char *label;
+  const char *detail;
+  VALUE (*func)(VALUE);
+  VALUE arg;
+} t_with_gvl_args;
+
+static void *t_dispatch_without_gvl(void *context) {
+  Libevent_Base *base = (Libevent_Base *)context;
+
+  return (void *)(long)event_base_dispatch(base->ev_base);
+}
+
+/*
+ * Unblocking function called by Ruby from another thread
+ * when loop thread has pending interrupt (i.e signal or Thread#raise)
+ */
+static void t_dispatch_unblock(void *context) {
+  Libevent_Base *base = (Libevent_Base *)context;
+
+  __atomic_store_n(&base->interrupted, 1, __ATOMIC_RELEASE);
+  event_base_loopbreak(base->ev_base);
+}
+
+static void *t_with_gvl(void *context) {
+  t_with_gvl_args *args = (t_with_gvl_args *)context;
+  Libevent_Profiler *profiler = args->base->profiler;
+  VALUE profiler_object = profiler ? profiler->self : Qnil;
+  int profiled;
+  int state = 0;
+
+  profiled = ( profiler && Libevent_Profiler_enter(profiler, args->kind, args->label, args->detail) );
+  rb_protect(args->func, args->arg, &state);
+  // callback may replace profiler (Base#profile), keep the one it entered alive until exit
+  if ( profiled )
+    Libevent_Profiler_exit(profiler);
+  RB_GC_GUARD(profiler_object);
+  if ( state && !args->base->error_state ) {
+    args->base->error_state = state;
+    // non exception jumps (throw, break) keep their state in errinfo
+    if ( RB_TYPE_P(rb_errinfo(), T_OBJECT) ) {
+      args->base->error = rb_errinfo();
+      rb_set_errinfo(Qnil);
+    }
+    event_base_loopbreak(args->base->ev_base);
+  }
+
+  return NULL;
+}
+
+/*
+ * Run Ruby code from libevent callback.
+ *
+ * Event loop runs without GVL so callback reacquires it.
+ * Exception can't be propagated through libevent frames: it breaks
+ * the loop and is re-raised by Base#dispatch.
+ * Kind and label (i.e. "http" and virtual host) identify handler for profiler histograms,
+ * label should be owned by handler so it is compared by address.
+ * Detail (i.e. request URI) is reported for slow callbacks only.
+ */
+void Libevent_Base_with_gvl(Libevent_Base *base, const char *kind, const char *label, const char *detail, VALUE (*func)(VALUE), VALUE arg) {
+  t_with_gvl_args args;
+
+  args.base = base;
+  args.kind = kind;
+  args.label = label;
+  args.detail = detail;
+  args.func = func;
+  args.arg = arg;
+
+#ifdef HAVE_RUBY_THREAD_H
+  rb_thread_call_with_gvl(t_with_gvl, &args);
+#else
+  t_with_gvl(&args);
+#endif
 }
 
 /*
@@ -48,35 +210,138 @@ static void t_free(Libevent_Base *base) {
  *
  * This loop will run the event base until either there are no more added events, 
  * or until something calls Libevent::Base#break_loop or Base#exit_loop.
+ *
+ * GVL is released while loop waits for events so other Ruby threads can run.
+ * Objects of the base (requests, listeners, websockets, broadcasts) can be used
+ * only by this thread while loop is running, other threads get ThreadError.
+ * Exception raised by handler stops the loop and is raised by this method.
  * @see #break_loop
  * @see #exit_loop
 */
 static VALUE t_dispatch(VALUE self) {
   Libevent_Base *base;
-  int status;
+  t_dispatch_args args;
 
   Data_Get_Struct(self, Libevent_Base, base);
-  status = event_base_dispatch(base->ev_base);
+  Libevent_Base_check_thread(base);
+
+  // nested loop (dispatch called from callback) restores outer loop thread
+  args.base = base;
+  args.thread = base->thread;
+  base->thread = rb_thread_current();
+
+  return rb_ensure(t_run_loop, (VALUE)base, t_stop_loop, (VALUE)&args);
+}
+
+static VALUE t_stop_loop(VALUE context) {
+  t_dispatch_args *args = (t_dispatch_args *)context;
+
+  args->base->thread = args->thread;
+
+  return Qnil;
+}
+
+static VALUE t_run_loop(VALUE context) {
+  Libevent_Base *base = (Libevent_Base *)context;
+  VALUE error;
+  int status;
+  int state;
+
+  for (;;) {
+    __atomic_store_n(&base->interrupted, 0, __ATOMIC_RELEASE);
+#ifdef HAVE_RUBY_THREAD_H
+    status = (int)(long)rb_thread_call_without_gvl(t_dispatch_without_gvl, base, t_dispatch_unblock, base);
+#else
+    status = (int)(long)t_dispatch_without_gvl(base);
+#endif
+
+    if ( base->error_state ) {
+      state = base->error_state;
+      error = base->error;
+      base->error_state = 0;
+      base->error = Qnil;
+      if ( error != Qnil )
+        rb_exc_raise(error);
+      rb_jump_tag(state);
+    }
+
+    if ( !__atomic_load_n(&base->interrupted, __ATOMIC_ACQUIRE) )
+      break;
+
+    // handle pending interrupts (may raise) and continue loop
+    rb_thread_check_ints();
+  }
 
   return INT2FIX(status);
 }
 
 /*
- * Exit the event loop after the specified time
+ * Exit the event loop after the specified time. Can be called from any thread.
+ *
+ * @overload exit_loop(timeout = nil)
+ * @param [Numeric] timeout seconds to wait before exit, nil to exit after current iteration
+ * @return [true false]
+ */
+static VALUE t_exit_loop(int argc, VALUE *argv, VALUE self) {
+  Libevent_Base *base;
+  VALUE timeout;
+  struct timeval tv;
+  int status;
+
+  Data_Get_Struct(self, Libevent_Base, base);
+  rb_scan_args(argc, argv, "01", &timeout);
+
+  if ( timeout == Qnil ) {
+    status = event_base_loopexit(base->ev_base, NULL);
+  } else {
+    tv = rb_time_interval(timeout);
+    status = event_base_loopexit(base->ev_base, &tv);
+  }
+
+  return (status == -1 ? Qfalse : Qtrue);
+}
+
+/*
+ * Exit the event loop as soon as all in-flight http requests are finished
+ * but no later than timeout.
  *
- * @todo specified time is not implemented
+ * @note call Http#stop_accepting first so no new requests are started.
+ *   Replies sent while draining have "Connection: close" header.
+ * @param [Numeric] timeout seconds to wait for in-flight requests
+ * @return [true false]
+ * @raise [ThreadError] if loop is running in another thread
  */
-static VALUE t_exit_loop(VALUE self) {
+static VALUE t_graceful_exit(VALUE self, VALUE timeout) {
   Libevent_Base *base;
+  struct timeval tv;
   int status;
 
   Data_Get_Struct(self, Libevent_Base, base);
-  status = event_base_loopexit(base->ev_base, NULL);
+  Libevent_Base_check_thread(base);
+  tv = rb_time_interval(timeout);
+  base->draining = 1;
+
+  if ( base->requests == 0 )
+    status = event_base_loopexit(base->ev_base, NULL);
+  else
+    status = event_base_loopexit(base->ev_base, &tv);
 
   return (status == -1 ? Qfalse : Qtrue);
 }
+
+/*
+ * Get number of in-flight http requests of all http instances of event base
+ * @return [Fixnum]
+ */
+static VALUE t_get_requests(VALUE self) {
+  Libevent_Base *base;
+
+  Data_Get_Struct(self, Libevent_Base, base);
+
+  return INT2FIX(base->requests);
+}
 /*
- * Abort the active event_base loop immediately.
+ * Abort the active event_base loop immediately. Can be called from any thread.
  *
  * It will abort the loop after the next event is completed;
  * event_base_loopbreak() is typically invoked from this event's callback. 
@@ -92,3 +357,67 @@ static VALUE t_break_loop(VALUE self) {
 
   return (status == -1 ? Qfalse : Qtrue);
 }
+
+/*
+ * Replace event base of new instance by one that checks for new events
+ * after max_dispatch_callbacks callbacks of priority 1 and less urgent were run,
+ * so events of priority 0 do not wait for whole active queue.
+ *
+ * @note use Base.new(:max_dispatch_callbacks => n)
+ * @param [Fixnum] max_dispatch_callbacks
+ * @return [nil]
+ */
+static VALUE t_configure(VALUE self, VALUE max_dispatch_callbacks) {
+  Libevent_Base *base;
+  struct event_config *ev_config;
+  struct event_base *ev_base;
+
+  Data_Get_Struct(self, Libevent_Base, base);
+
+  if ( base->refs > 0 )
+    rb_raise(rb_eRuntimeError, "event base is already in use");
+
+  ev_config = event_config_new();
+  event_config_set_max_dispatch_interval(ev_config, NULL, NUM2INT(max_dispatch_callbacks), 1);
+  ev_base = event_base_new_with_config(ev_config);
+  event_config_free(ev_config);
+
+  if ( !ev_base )
+    rb_fatal("Couldn't get an event base");
+
+  event_base_free(base->ev_base);
+  base->ev_base = ev_base;
+
+  return Qnil;
+}
+
+/*
+ * Set number of event priorities. Priority 0 is the most important,
+ * events without explicit priority get priorities / 2.
+ *
+ * @note call before events are added (signals trapped, http servers created)
+ * @param [Fixnum] priorities number of priorities
+ * @return [true false]
+ */
+static VALUE t_init_priorities(VALUE self, VALUE priorities) {
+  Libevent_Base *base;
+  int status;
+
+  Data_Get_Struct(self, Libevent_Base, base);
+
+  status = event_base_priority_init(base->ev_base, NUM2INT(priorities));
+
+  return (status == -1 ? Qfalse : Qtrue);
+}
+
+/*
+ * Get number of event priorities
+ * @return [Fixnum]
+ */
+static VALUE t_get_priorities(VALUE self) {
+  Libevent_Base *base;
+
+  Data_Get_Struct(self, Libevent_Base, base);
+
+  return INT2FIX(event_base_get_npriorities(base->ev_base));
+}
@@ -0,0 +1,429 @@
+#include "ext.h"
+
+#include <string.h>
+#include <event2/bufferevent.h>
+
+#define BROADCAST_POLICY_SKIP  0
+#define BROADCAST_POLICY_CLOSE 1
+
+#define BROADCAST_MAX_PENDING 1048576
+
+static VALUE t_allocate(VALUE klass);
+
+static void t_free(Libevent_Broadcast *broadcast);
+
+static VALUE t_initialize(int argc, VALUE *argv, VALUE self);
+
+static VALUE t_subscribe(VALUE self, VALUE request);
+
+static VALUE t_unsubscribe(VALUE self, VALUE request);
+
+static VALUE t_publish(int argc, VALUE *argv, VALUE self);
+
+static VALUE t_get_subscribers(VALUE self);
+
+static VALUE t_get_dropped(VALUE self);
+
+static void t_remove(Libevent_BroadcastSubscriber *subscriber);
+
+static void t_connection_closed(struct evhttp_connection *ev_connection, void *context);
+
+static void t_notify(evutil_socket_t fd, short events, void *context);
+
+void Init_libevent_broadcast() {
+  cLibevent_Broadcast = rb_define_class_under(mLibevent, "Broadcast", rb_cObject);
+
+  rb_define_alloc_func(cLibevent_Broadcast, t_allocate);
+
+  rb_define_method(cLibevent_Broadcast, "initialize", t_initialize, -1);
+  rb_define_method(cLibevent_Broadcast, "subscribe", t_subscribe, 1);
+  rb_define_method(cLibevent_Broadcast, "unsubscribe", t_unsubscribe, 1);
+  rb_define_method(cLibevent_Broadcast, "publish", t_publish, -1);
+  rb_define_method(cLibevent_Broadcast, "subscribers", t_get_subscribers, 0);
+  rb_define_method(cLibevent_Broadcast, "dropped", t_get_dropped, 0);
+}
+
+/*
+ * Allocate memory
+ */
+static VALUE t_allocate(VALUE klass) {
+  Libevent_Broadcast *broadcast = ALLOC(Libevent_Broadcast);
+
+  broadcast->base = NULL;
+  broadcast->ev_buffer = NULL;
+  broadcast->ev_notify = NULL;
+  broadcast->frames = NULL;
+  broadcast->frames_tail = NULL;
+  broadcast->subscribers = NULL;
+  broadcast->count = 0;
+  broadcast->max_pending = BROADCAST_MAX_PENDING;
+  broadcast->policy = BROADCAST_POLICY_SKIP;
+  broadcast->dropped = 0;
+
+  return Data_Wrap_Struct(klass, 0, t_free, broadcast);
+}
+
+/*
+ * Free memory. Streams of remaining subscribers are finished.
+ */
+static void t_free(Libevent_Broadcast *broadcast) {
+  Libevent_BroadcastFrame *frame;
+
+  if ( broadcast->ev_notify ) {
+    event_free(broadcast->ev_notify);
+    pthread_mutex_destroy(&broadcast->mutex);
+  }
+
+  // messages published from other threads and not flushed yet are dropped
+  while ( (frame = broadcast->frames) ) {
+    broadcast->frames = frame->next;
+    free(frame);
+  }
+
+  while ( broadcast->subscribers )
+    t_remove(broadcast->subscribers);
+
+  if ( broadcast->ev_buffer )
+    evbuffer_free(broadcast->ev_buffer);
+
+  if ( broadcast->base )
+    Libevent_Base_release(broadcast->base);
+
+  xfree(broadcast);
+}
+
+/*
+ * Initialize broadcast channel
+ *
+ * @overload initialize(base, options = {})
+ * @param [Base] base event base of subscribed requests
+ * @param [Hash] options
+ * @option options [Fixnum] :max_pending (1MB) output bytes not yet sent to subscriber considered as slow
+ * @option options [Symbol] :policy (:skip) :skip messages for slow subscriber or :close its stream
+ */
+static VALUE t_initialize(int argc, VALUE *argv, VALUE self) {
+  Libevent_Broadcast *broadcast;
+  Libevent_Base *base;
+  VALUE object;
+  VALUE options;
+  VALUE value;
+  const char *policy_name;
+
+  Data_Get_Struct(self, Libevent_Broadcast, broadcast);
+  rb_scan_args(argc, argv, "11", &object, &options);
+  Data_Get_Struct(object, Libevent_Base, base);
+
+  if ( options != Qnil ) {
+    Check_Type(options, T_HASH);
+
+    value = rb_hash_aref(options, ID2SYM(rb_intern("max_pending")));
+    if ( value != Qnil )
+      broadcast->max_pending = NUM2ULONG(value);
+
+    value = rb_hash_aref(options, ID2SYM(rb_intern("policy")));
+    if ( value != Qnil ) {
+      policy_name = RSTRING_PTR(rb_funcall(value, rb_intern("to_s"), 0));
+      if ( strcmp(policy_name, "skip") == 0 )
+        broadcast->policy = BROADCAST_POLICY_SKIP;
+      else if ( strcmp(policy_name, "close") == 0 )
+        broadcast->policy = BROADCAST_POLICY_CLOSE;
+      else
+        rb_raise(rb_eArgError, "unknown broadcast policy given");
+    }
+  }
+
+  broadcast->base = base;
+  Libevent_Base_retain(base);
+  broadcast->ev_buffer = evbuffer_new();
+  broadcast->ev_notify = event_new(base->ev_base, -1, 0, t_notify, (void *)broadcast);
+  if ( !broadcast->ev_notify )
+    rb_raise(rb_eRuntimeError, "Couldn't create broadcast notification event");
+  pthread_mutex_init(&broadcast->mutex, NULL);
+  rb_iv_set(self, "@base", object);
+
+  return self;
+}
+
+/*
+ * Start event stream reply and add request to subscribers.
+ * Stream is owned by broadcast from now on: it is finished by #unsubscribe
+ * or when slow subscriber is closed, disconnected clients are removed automatically.
+ *
+ * @param [HttpRequest] request request handled in event loop thread
+ * @return [nil]
+ */
+static VALUE t_subscribe(VALUE self, VALUE request) {
+  Libevent_Broadcast *broadcast;
+  Libevent_HttpRequest *http_request;
+  Libevent_BroadcastSubscriber *subscriber;
+  struct evhttp_connection *ev_connection;
+  struct evkeyvalq *headers;
+
+  Data_Get_Struct(self, Libevent_Broadcast, broadcast);
+  Data_Get_Struct(request, Libevent_HttpRequest, http_request);
+
+  if ( http_request->threaded )
+    rb_raise(rb_eNotImpError, "broadcast is supported only by event loop handler");
+  Libevent_Base_check_thread(broadcast->base);
+  if ( http_request->finished )
+    rb_raise(rb_eRuntimeError, "reply is already finished");
+
+  ev_connection = evhttp_request_get_connection(http_request->ev_request);
+  if ( !ev_connection )
+    rb_raise(rb_eIOError, "connection is closed");
+
+  headers = evhttp_request_get_output_headers(http_request->ev_request);
+  if ( !evhttp_find_header(headers, "Content-Type") )
+    evhttp_add_header(headers, "Content-Type", "text/event-stream");
+  evhttp_add_header(headers, "Cache-Control", "no-cache");
+  evhttp_send_reply_start(http_request->ev_request, 200, "OK");
+
+  // stream is never completed by evhttp, it does not hold graceful stop
+  evhttp_request_set_on_complete_cb(http_request->ev_request, NULL, NULL);
+  Libevent_Http_request_done(http_request->http);
+  http_request->finished = 1;
+
+  subscriber = ALLOC(Libevent_BroadcastSubscriber);
+  subscriber->broadcast = broadcast;
+  subscriber->ev_request = http_request->ev_request;
+  subscriber->ev_connection = ev_connection;
+  subscriber->access_log = http_request->access_log;
+  if ( subscriber->access_log )
+    Libevent_AccessLog_retain(subscriber->access_log);
+  subscriber->start = http_request->start;
+  subscriber->bytes = 0;
+  subscriber->prev = NULL;
+  subscriber->next = broadcast->subscribers;
+  if ( broadcast->subscribers )
+    broadcast->subscribers->prev = subscriber;
+  broadcast->subscribers = subscriber;
+  broadcast->count++;
+
+  evhttp_connection_set_closecb(ev_connection, t_connection_closed, subscriber);
+
+  return Qnil;
+}
+
+/*
+ * Finish event stream of request
+ *
+ * @param [HttpRequest] request subscribed request
+ * @return [true false] false if request is not subscribed
+ */
+static VALUE t_unsubscribe(VALUE self, VALUE request) {
+  Libevent_Broadcast *broadcast;
+  Libevent_HttpRequest *http_request;
+  Libevent_BroadcastSubscriber *subscriber;
+
+  Data_Get_Struct(self, Libevent_Broadcast, broadcast);
+  Data_Get_Struct(request, Libevent_HttpRequest, http_request);
+  Libevent_Base_check_thread(broadcast->base);
+
+  for ( subscriber = broadcast->subscribers; subscriber; subscriber = subscriber->next ) {
+    if ( subscriber->ev_request == http_request->ev_request ) {
+      t_remove(subscriber);
+      return Qtrue;
+    }
+  }
+
+  return Qfalse;
+}
+
+static void t_frame_release(const void *data, size_t length, void *context) {
+  Libevent_BroadcastFrame *frame = (Libevent_BroadcastFrame *)context;
+
+  if ( --frame->refs == 0 )
+    free(frame);
+}
+
+/*
+ * Append SSE field to frame, value lines are split to separate fields
+ */
+static void t_encode_field(struct evbuffer *buffer, const char *name, const char *value, long length) {
+  const char *end = value + length;
+  const char *line;
+
+  do {
+    for ( line = value; value < end && *value != '\n' && *value != '\r'; value++ );
+    evbuffer_add_printf(buffer, "%s: ", name);
+    evbuffer_add(buffer, line, value - line);
+    evbuffer_add(buffer, "\n", 1);
+    if ( value < end && *value == '\r' && value + 1 < end && value[1] == '\n' )
+      value++;
+  } while ( value++ < end );
+}
+
+/*
+ * Send frame to all subscribers and drop publisher reference
+ */
+static int t_deliver(Libevent_Broadcast *broadcast, Libevent_BroadcastFrame *frame) {
+  Libevent_BroadcastSubscriber *subscriber;
+  Libevent_BroadcastSubscriber *next;
+  struct bufferevent *ev_bufferevent;
+  int sent = 0;
+
+  for ( subscriber = broadcast->subscribers; subscriber; subscriber = next ) {
+    next = subscriber->next;
+
+    ev_bufferevent = evhttp_connection_get_bufferevent(subscriber->ev_connection);
+    if ( evbuffer_get_length(bufferevent_get_output(ev_bufferevent)) > broadcast->max_pending ) {
+      broadcast->dropped++;
+      if ( broadcast->policy == BROADCAST_POLICY_CLOSE )
+        t_remove(subscriber);
+      continue;
+    }
+
+    // reference chain is moved to connection output without copying data
+    frame->refs++;
+    evbuffer_add_reference(broadcast->ev_buffer, frame->data, frame->length, t_frame_release, frame);
+    evhttp_send_reply_chunk(subscriber->ev_request, broadcast->ev_buffer);
+    // reply without body (HEAD request) leaves chunk in place
+    evbuffer_drain(broadcast->ev_buffer, evbuffer_get_length(broadcast->ev_buffer));
+    subscriber->bytes += frame->length;
+    sent++;
+  }
+
+  t_frame_release(frame->data, frame->length, frame);
+
+  return sent;
+}
+
+/*
+ * Send message to all subscribers. Event stream frame is encoded once and
+ * its memory is shared by output buffers of all subscribers.
+ * Message published from other thread while loop is running is queued and
+ * sent from event loop thread.
+ *
+ * @overload publish(data, event = nil, id = nil)
+ * @param [String] data message, multiple lines are sent as multiple data fields
+ * @param [String nil] event event type
+ * @param [String nil] id event id
+ * @return [Fixnum nil] number of subscribers message is queued for, nil if message is queued for event loop thread
+ */
+static VALUE t_publish(int argc, VALUE *argv, VALUE self) {
+  Libevent_Broadcast *broadcast;
+  struct evbuffer *encoded;
+  Libevent_BroadcastFrame *frame;
+  VALUE data;
+  VALUE event;
+  VALUE id;
+
+  Data_Get_Struct(self, Libevent_Broadcast, broadcast);
+  rb_scan_args(argc, argv, "12", &data, &event, &id);
+  Check_Type(data, T_STRING);
+
+  encoded = evbuffer_new();
+  if ( id != Qnil )
+    t_encode_field(encoded, "id", StringValuePtr(id), RSTRING_LEN(id));
+  if ( event != Qnil )
+    t_encode_field(encoded, "event", StringValuePtr(event), RSTRING_LEN(event));
+  t_encode_field(encoded, "data", RSTRING_PTR(data), RSTRING_LEN(data));
+  evbuffer_add(encoded, "\n", 1);
+
+  // publisher holds one reference until all subscribers got theirs
+  frame = malloc(sizeof(Libevent_BroadcastFrame) + evbuffer_get_length(encoded));
+  frame->refs = 1;
+  frame->length = evbuffer_get_length(encoded);
+  frame->next = NULL;
+  evbuffer_remove(encoded, frame->data, frame->length);
+  evbuffer_free(encoded);
+
+  if ( broadcast->base->thread == Qnil || broadcast->base->thread == rb_thread_current() )
+    return INT2FIX(t_deliver(broadcast, frame));
+
+  pthread_mutex_lock(&broadcast->mutex);
+  if ( broadcast->frames_tail )
+    broadcast->frames_tail->next = frame;
+  else
+    broadcast->frames = frame;
+  broadcast->frames_tail = frame;
+  pthread_mutex_unlock(&broadcast->mutex);
+
+  event_active(broadcast->ev_notify, 0, 0);
+
+  return Qnil;
+}
+
+/*
+ * @return [Fixnum] number of subscribers
+ */
+static VALUE t_get_subscribers(VALUE self) {
+  Libevent_Broadcast *broadcast;
+
+  Data_Get_Struct(self, Libevent_Broadcast, broadcast);
+
+  return INT2FIX(broadcast->count);
+}
+
+/*
+ * @return [Fixnum] number of messages not sent to slow subscribers
+ */
+static VALUE t_get_dropped(VALUE self) {
+  Libevent_Broadcast *broadcast;
+
+  Data_Get_Struct(self, Libevent_Broadcast, broadcast);
+
+  return ULONG2NUM(broadcast->dropped);
+}
+
+/*
+ * Unlink subscriber and finish its stream
+ */
+static void t_unlink(Libevent_BroadcastSubscriber *subscriber) {
+  Libevent_Broadcast *broadcast = subscriber->broadcast;
+
+  if ( subscriber->prev )
+    subscriber->prev->next = subscriber->next;
+  else
+    broadcast->subscribers = subscriber->next;
+  if ( subscriber->next )
+    subscriber->next->prev = subscriber->prev;
+  broadcast->count--;
+
+  if ( subscriber->access_log ) {
+    Libevent_AccessLog_push(subscriber->access_log, subscriber->ev_request, 200, subscriber->bytes, &subscriber->start);
+    Libevent_AccessLog_release(subscriber->access_log);
+  }
+}
+
+static void t_remove(Libevent_BroadcastSubscriber *subscriber) {
+  t_unlink(subscriber);
+  evhttp_connection_set_closecb(subscriber->ev_connection, NULL, NULL);
+  evhttp_send_reply_end(subscriber->ev_request);
+  xfree(subscriber);
+}
+
+/*
+ * C callback function invoked when subscriber connection is closed
+ */
+static void t_connection_closed(struct evhttp_connection *ev_connection, void *context) {
+  Libevent_BroadcastSubscriber *subscriber = (Libevent_BroadcastSubscriber *)context;
+
+  t_unlink(subscriber);
+
+  // request detached from failed connection is left to its owner
+  if ( evhttp_request_get_connection(subscriber->ev_request) == NULL )
+    evhttp_send_reply_end(subscriber->ev_request);
+
+  xfree(subscriber);
+}
+
+/*
+ * C callback function that sends queued messages from event loop thread.
+ */
+static void t_notify(evutil_socket_t fd, short events, void *context) {
+  Libevent_Broadcast *broadcast = (Libevent_Broadcast *)context;
+  Libevent_BroadcastFrame *frame;
+  Libevent_BroadcastFrame *next;
+
+  pthread_mutex_lock(&broadcast->mutex);
+  frame = broadcast->frames;
+  broadcast->frames = NULL;
+  broadcast->frames_tail = NULL;
+  pthread_mutex_unlock(&broadcast->mutex);
+
+  for ( ; frame; frame = next ) {
+    next = frame->next;
+    t_deliver(broadcast, frame);
+  }
+}
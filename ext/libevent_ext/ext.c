@@ -5,12 +5,25 @@ VALUE cLibevent_Base;
 VALUE cLibevent_Signal;
 VALUE cLibevent_Http;
 VALUE cLibevent_HttpRequest;
+VALUE cLibevent_AccessLog;
+VALUE cLibevent_WebSocket;
+VALUE cLibevent_Broadcast;
+VALUE cLibevent_Profiler;
 
 void Init_libevent_ext() {
+  // libevent calls are made from event loop thread only, but handler threads
+  // wake it up with event_active so base locking is required
+  if ( evthread_use_pthreads() == -1 )
+    rb_fatal("Couldn't enable libevent pthreads support");
+
   mLibevent = rb_define_module("Libevent");
 
   Init_libevent_base();
   Init_libevent_signal();
   Init_libevent_http();
   Init_libevent_http_request();
+  Init_libevent_access_log();
+  Init_libevent_websocket();
+  Init_libevent_broadcast();
+  Init_libevent_profiler();
 }
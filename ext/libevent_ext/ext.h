@@ -3,38 +3,238 @@
 
 #include "ruby.h"
 #include "ruby18_compat.h"
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+#ifdef HAVE_RUBY_ENCODING_H
+#include "ruby/encoding.h"
+#endif
 
 #include <event.h>
 #include <evhttp.h>
+#include <event2/thread.h>
+#include <pthread.h>
+
+#define LIBEVENT_ACCESS_LOG_CAPACITY 4096
+#define LIBEVENT_ACCESS_LOG_URI_MAX  512
+
+#define LIBEVENT_PROFILER_LABELS     256
+#define LIBEVENT_PROFILER_LABEL_MAX  96
+#define LIBEVENT_PROFILER_DETAIL_MAX 512
+#define LIBEVENT_PROFILER_BUCKETS    24
+
+#define LIBEVENT_PARAMS_MAX_COUNT    1024
+#define LIBEVENT_PARAMS_MAX_KEY_SIZE 1024
 
 extern VALUE mLibevent;
 extern VALUE cLibevent_Base;
 extern VALUE cLibevent_Signal;
 extern VALUE cLibevent_Http;
 extern VALUE cLibevent_HttpRequest;
+extern VALUE cLibevent_AccessLog;
+extern VALUE cLibevent_WebSocket;
+extern VALUE cLibevent_Broadcast;
+extern VALUE cLibevent_Profiler;
+
+#define LIBEVENT_REPLY_START 0
+#define LIBEVENT_REPLY_CHUNK 1
+#define LIBEVENT_REPLY_END   2
+#define LIBEVENT_REPLY_ERROR 3
 
 typedef struct Libevent_Base {
   struct event_base *ev_base;
+  int refs;
+  int freed;
+  int requests;
+  int draining;
+  int interrupted;
+  int error_state;
+  VALUE error;
+  VALUE thread;
+  struct Libevent_Profiler *profiler;
 } Libevent_Base;
 
 typedef struct Libevent_Signal {
   struct event *ev_event;
+  Libevent_Base *base;
+  VALUE handler;
+  char name[16];
 } Libevent_Signal;
 
+typedef struct Libevent_AccessLogEntry {
+  struct timeval time;
+  long duration;
+  int status;
+  size_t bytes;
+  char major;
+  char minor;
+  char method[8];
+  char remote_host[48];
+  char uri[LIBEVENT_ACCESS_LOG_URI_MAX];
+} Libevent_AccessLogEntry;
+
+typedef struct Libevent_AccessLog {
+  int refs;
+  char *path;
+  int fd;
+  int format;
+  Libevent_AccessLogEntry *entries;
+  unsigned long head;
+  unsigned long tail;
+  unsigned long dropped;
+  int running;
+  int reopen;
+  int detached;
+  pthread_t writer;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} Libevent_AccessLog;
+
+typedef struct Libevent_HttpReply {
+  int type;
+  int code;
+  char *reason;
+  struct evbuffer *ev_buffer;
+  struct evhttp_request *ev_request;
+  Libevent_AccessLog *access_log;
+  struct timeval start;
+  size_t bytes;
+  struct Libevent_HttpReply *next;
+} Libevent_HttpReply;
+
 typedef struct Libevent_Http {
+  Libevent_Base *base;
   struct event_base *ev_base;
   struct evhttp *ev_http;
   struct evhttp *ev_http_parent;
+  VALUE request_handler;
+  Libevent_AccessLog *access_log;
+  int threads;
+  int priority;
+  char label[64];
+  struct event *ev_reply_notify;
+  pthread_mutex_t reply_mutex;
+  Libevent_HttpReply *replies;
+  Libevent_HttpReply *replies_tail;
 } Libevent_Http;
 
 typedef struct Libevent_HttpRequest {
   struct evhttp_request *ev_request;
   struct evbuffer *ev_buffer;
+  Libevent_AccessLog *access_log;
+  Libevent_Http *http;
+  struct timeval start;
+  size_t bytes;
+  int threaded;
+  int started;
+  int finished;
 } Libevent_HttpRequest;
 
+typedef struct Libevent_WebSocket {
+  Libevent_Base *base;
+  struct evhttp_connection *ev_connection;
+  struct bufferevent *ev_bufferevent;
+  struct evbuffer *ev_message;
+  VALUE self;
+  size_t max_message_size;
+  int opcode;
+  int state;
+  int close_code;
+  char close_reason[124];
+} Libevent_WebSocket;
+
+typedef struct Libevent_BroadcastSubscriber {
+  struct Libevent_Broadcast *broadcast;
+  struct evhttp_request *ev_request;
+  struct evhttp_connection *ev_connection;
+  Libevent_AccessLog *access_log;
+  struct timeval start;
+  size_t bytes;
+  struct Libevent_BroadcastSubscriber *prev;
+  struct Libevent_BroadcastSubscriber *next;
+} Libevent_BroadcastSubscriber;
+
+typedef struct Libevent_BroadcastFrame {
+  int refs;
+  size_t length;
+  struct Libevent_BroadcastFrame *next;
+  char data[1];
+} Libevent_BroadcastFrame;
+
+typedef struct Libevent_Broadcast {
+  Libevent_Base *base;
+  struct evbuffer *ev_buffer;
+  struct event *ev_notify;
+  pthread_mutex_t mutex;
+  Libevent_BroadcastFrame *frames;
+  Libevent_BroadcastFrame *frames_tail;
+  Libevent_BroadcastSubscriber *subscribers;
+  int count;
+  size_t max_pending;
+  int policy;
+  unsigned long dropped;
+} Libevent_Broadcast;
+
+typedef struct Libevent_ProfilerEntry {
+  const void *key;
+  char label[LIBEVENT_PROFILER_LABEL_MAX];
+  unsigned long count;
+  unsigned long long total;
+  unsigned long long max;
+  unsigned long buckets[LIBEVENT_PROFILER_BUCKETS];
+} Libevent_ProfilerEntry;
+
+typedef struct Libevent_Profiler {
+  Libevent_Base *base;
+  VALUE self;
+  unsigned long sample;
+  unsigned long calls;
+  unsigned long long threshold;
+  Libevent_ProfilerEntry *entries;
+  int count;
+  unsigned long long started;
+  unsigned long long busy;
+  unsigned long id;
+  int active;
+  unsigned long long start;
+  const char *kind;
+  const char *label;
+  char detail[LIBEVENT_PROFILER_DETAIL_MAX];
+  VALUE thread;
+  VALUE backtrace;
+} Libevent_Profiler;
+
 void Init_libevent_base();
 void Init_libevent_signal();
 void Init_libevent_http();
 void Init_libevent_http_request();
+void Init_libevent_access_log();
+void Init_libevent_websocket();
+void Init_libevent_broadcast();
+void Init_libevent_profiler();
+
+void Libevent_Base_retain(Libevent_Base *base);
+
+void Libevent_Base_release(Libevent_Base *base);
+
+void Libevent_Base_check_thread(Libevent_Base *base);
+
+void Libevent_Base_with_gvl(Libevent_Base *base, const char *kind, const char *label, const char *detail, VALUE (*func)(VALUE), VALUE arg);
+
+void Libevent_Http_queue_reply(Libevent_Http *http, Libevent_HttpReply *reply);
+
+void Libevent_Http_request_done(Libevent_Http *http);
+
+int Libevent_Profiler_enter(Libevent_Profiler *profiler, const char *kind, const char *label, const char *detail);
+
+void Libevent_Profiler_exit(Libevent_Profiler *profiler);
+
+VALUE Libevent_parse_params(const char *data, size_t length);
+
+void Libevent_AccessLog_retain(Libevent_AccessLog *log);
+
+void Libevent_AccessLog_release(Libevent_AccessLog *log);
+
+void Libevent_AccessLog_push(Libevent_AccessLog *log, struct evhttp_request *ev_request, int status, size_t bytes, const struct timeval *start);
 
 #endif
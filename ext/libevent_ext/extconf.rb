@@ -2,6 +2,11 @@ require "mkmf"
 
 $CFLAGS << ' -Wall '
 
-$LDFLAGS << ' ' << `pkg-config --libs libevent`
+$LDFLAGS << ' ' << `pkg-config --libs libevent_pthreads libevent`.strip
+
+have_library('pthread')
+have_header('ruby/thread.h')
+have_header('ruby/encoding.h')
+have_func('rb_interned_str_cstr')
 
 create_makefile('libevent_ext')
@@ -1,31 +1,72 @@
 #include "ext.h"
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <event2/listener.h>
+#include <event2/bufferevent.h>
+
 static VALUE t_allocate(VALUE klass);
 
 static void t_free(Libevent_Http *http);
 
 static VALUE t_initialize(VALUE self, VALUE object);
 
-static VALUE t_bind_socket(VALUE self, VALUE address, VALUE port);
+static VALUE t_bind_socket(int argc, VALUE *argv, VALUE self);
+
+static int t_bind_listener(Libevent_Http *http, const char *address, int port, VALUE options);
+
+static VALUE t_bind_unix_socket(VALUE self, VALUE path, VALUE mode);
+
+static int t_unlink_stale_socket(struct sockaddr_un *address);
+
+static VALUE t_accept_socket(VALUE self, VALUE socket);
 
-static VALUE t_set_request_handler(VALUE self, VALUE handler);
+static VALUE t_set_request_handler(int argc, VALUE *argv, VALUE self);
 
 static VALUE t_set_timeout(VALUE self, VALUE timeout);
 
 static void t_request_handler(struct evhttp_request *ev_request, void *context);
 
+static VALUE t_call_request_handler(VALUE context);
+
+static void t_request_complete(struct evhttp_request *ev_request, void *context);
+
+static void t_reply_notify(evutil_socket_t fd, short events, void *context);
+
+static VALUE t_get_listener_fds(VALUE self);
+
+static VALUE t_stop_accepting(VALUE self);
+
 static VALUE t_add_virtual_host(VALUE self, VALUE domain, VALUE vhttp);
 
+static VALUE t_set_priority(VALUE self, VALUE priority);
+
+static struct bufferevent *t_bufferevent(struct event_base *ev_base, void *context);
+
+static VALUE t_set_access_log(VALUE self, VALUE access_log);
+
 void Init_libevent_http() {
   cLibevent_Http = rb_define_class_under(mLibevent, "Http", rb_cObject);
   
   rb_define_alloc_func(cLibevent_Http, t_allocate);
 
   rb_define_method(cLibevent_Http, "initialize", t_initialize, 1);
-  rb_define_method(cLibevent_Http, "bind_socket", t_bind_socket, 2);
-  rb_define_method(cLibevent_Http, "set_request_handler", t_set_request_handler, 1);
+  rb_define_method(cLibevent_Http, "bind_socket", t_bind_socket, -1);
+  rb_define_method(cLibevent_Http, "bind_unix_socket", t_bind_unix_socket, 2);
+  rb_define_method(cLibevent_Http, "accept_socket", t_accept_socket, 1);
+  rb_define_method(cLibevent_Http, "set_request_handler", t_set_request_handler, -1);
   rb_define_method(cLibevent_Http, "set_timeout", t_set_timeout, 1);
   rb_define_method(cLibevent_Http, "add_virtual_host", t_add_virtual_host, 2);
+  rb_define_method(cLibevent_Http, "set_access_log", t_set_access_log, 1);
+  rb_define_method(cLibevent_Http, "listener_fds", t_get_listener_fds, 0);
+  rb_define_method(cLibevent_Http, "stop_accepting", t_stop_accepting, 0);
+  rb_define_method(cLibevent_Http, "set_priority", t_set_priority, 1);
 }
 
 /*
@@ -34,9 +75,18 @@ void Init_libevent_http() {
 static VALUE t_allocate(VALUE klass) {
   Libevent_Http *http = ALLOC(Libevent_Http);
 
+  http->base = NULL;
   http->ev_base = NULL;
   http->ev_http = NULL;
   http->ev_http_parent = NULL;
+  http->request_handler = Qnil;
+  http->access_log = NULL;
+  http->threads = 0;
+  http->priority = -1;
+  http->label[0] = '\0';
+  http->ev_reply_notify = NULL;
+  http->replies = NULL;
+  http->replies_tail = NULL;
 
   return Data_Wrap_Struct(klass, 0, t_free, http); 
 }
@@ -46,11 +96,21 @@ static VALUE t_allocate(VALUE klass) {
  */
 static void t_free(Libevent_Http *http) {
   if ( http->ev_http ) {
-    // main http frees all associated vhosts
-    if ( http->ev_http_parent == NULL )
+    // main http frees all associated vhosts.
+    // After graceful stop connections are left to be closed by the kernel on exit:
+    // evhttp_free would reset connections of requests still in flight.
+    if ( http->ev_http_parent == NULL && !http->base->draining )
       evhttp_free(http->ev_http);
   }
 
+  if ( http->ev_reply_notify ) {
+    event_free(http->ev_reply_notify);
+    pthread_mutex_destroy(&http->reply_mutex);
+  }
+
+  if ( http->base )
+    Libevent_Base_release(http->base);
+
   xfree(http);
 }
 
@@ -67,14 +127,17 @@ static VALUE t_initialize(VALUE self, VALUE object) {
   Data_Get_Struct(self, Libevent_Http, http);
   Data_Get_Struct(object, Libevent_Base, base);
 
+  http->base = base;
   http->ev_base = base->ev_base;
   http->ev_http = evhttp_new(http->ev_base);
+  Libevent_Base_retain(base);
 
   if (!http->ev_http) {
     rb_fatal("Couldn't create evhttp");
   }
 
   rb_iv_set(self, "@base", object);
+  rb_ary_push(rb_iv_get(object, "@https"), self);
 
   if (rb_block_given_p())
     rb_yield(self);
@@ -85,61 +148,396 @@ static VALUE t_initialize(VALUE self, VALUE object) {
 /*
  * Binds an HTTP instance on the specified address and port.
  * Can be called multiple times to bind the same http server to multiple different ports.
+ * @overload bind_socket(address, port, options = {})
  * @param [String] address IP address
  * @param [Fixnum] port port to bind
+ * @param [Hash] options listening socket options
+ * @option options [Fixnum] :backlog listen queue length (default 128)
+ * @option options [true false] :reuseport set SO_REUSEPORT so several processes can bind the same port
+ * @option options [true false] :defer_accept set TCP_DEFER_ACCEPT so connection is accepted once data arrives
+ * @option options [true Fixnum] :fastopen enable TCP_FASTOPEN with given (or default 256) queue length
+ * @option options [true false] :nodelay set TCP_NODELAY on listening socket. Accepted connections inherit it on Linux and BSD
  * @return [true] on success
  * @return [false] on failure
  */
-static VALUE t_bind_socket(VALUE self, VALUE address, VALUE port) {
+static VALUE t_bind_socket(int argc, VALUE *argv, VALUE self) {
   Libevent_Http *http;
+  VALUE address;
+  VALUE port;
+  VALUE options;
   int status;
 
   Data_Get_Struct(self, Libevent_Http, http);
+  rb_scan_args(argc, argv, "21", &address, &port, &options);
+  Libevent_Base_check_thread(http->base);
   Check_Type(address, T_STRING);
   Check_Type(port, T_FIXNUM);
-  status = evhttp_bind_socket(http->ev_http, RSTRING_PTR(address), FIX2INT(port));
+
+  if ( options == Qnil ) {
+    status = evhttp_bind_socket(http->ev_http, RSTRING_PTR(address), FIX2INT(port));
+  } else {
+    Check_Type(options, T_HASH);
+    status = t_bind_listener(http, RSTRING_PTR(address), FIX2INT(port), options);
+  }
+
+  // first listener names http instance in profiler stats
+  if ( status == 0 && http->label[0] == '\0' )
+    snprintf(http->label, sizeof(http->label), "%s:%d", RSTRING_PTR(address), FIX2INT(port));
 
   return ( status == -1 ? Qfalse : Qtrue );
 }
 
+/*
+ * Create tuned listener with evconnlistener_new_bind and attach it to http
+ * @return [int] 0 on success, -1 on failure
+ */
+static int t_bind_listener(Libevent_Http *http, const char *address, int port, VALUE options) {
+  struct evutil_addrinfo hints;
+  struct evutil_addrinfo *ai = NULL;
+  struct evconnlistener *listener;
+  char service[8];
+  unsigned flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE;
+  int backlog = 128;
+  int one = 1;
+  evutil_socket_t fd;
+  VALUE value;
+
+  value = rb_hash_aref(options, ID2SYM(rb_intern("backlog")));
+  if ( value != Qnil )
+    backlog = NUM2INT(value);
+  if ( RTEST(rb_hash_aref(options, ID2SYM(rb_intern("reuseport")))) )
+    flags |= LEV_OPT_REUSEABLE_PORT;
+  if ( RTEST(rb_hash_aref(options, ID2SYM(rb_intern("defer_accept")))) )
+    flags |= LEV_OPT_DEFERRED_ACCEPT;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = EVUTIL_AI_PASSIVE | EVUTIL_AI_ADDRCONFIG;
+  snprintf(service, sizeof(service), "%d", port);
+  if ( evutil_getaddrinfo(address, service, &hints, &ai) != 0 )
+    return -1;
+
+  listener = evconnlistener_new_bind(http->ev_base, NULL, NULL, flags, backlog, ai->ai_addr, ai->ai_addrlen);
+  evutil_freeaddrinfo(ai);
+  if ( !listener )
+    return -1;
+
+  fd = evconnlistener_get_fd(listener);
+
+  if ( RTEST(rb_hash_aref(options, ID2SYM(rb_intern("nodelay")))) )
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&one, sizeof(one));
+
+#ifdef TCP_FASTOPEN
+  value = rb_hash_aref(options, ID2SYM(rb_intern("fastopen")));
+  if ( RTEST(value) ) {
+    int queue = ( value == Qtrue ? 256 : NUM2INT(value) );
+    setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, (void *)&queue, sizeof(queue));
+  }
+#endif
+
+  if ( !evhttp_bind_listener(http->ev_http, listener) ) {
+    evconnlistener_free(listener);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Remove socket file nobody listens on.
+ * @return [int] 0 if socket is alive (i.e. another instance is running)
+ */
+static int t_unlink_stale_socket(struct sockaddr_un *address) {
+  evutil_socket_t fd;
+  int status;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ( fd == -1 )
+    return 0;
+
+  // non-blocking probe: connection to live listener with full backlog fails with EAGAIN
+  evutil_make_socket_nonblocking(fd);
+  status = connect(fd, (struct sockaddr *)address, sizeof(*address));
+  if ( status == -1 && errno == ECONNREFUSED )
+    status = unlink(address->sun_path);
+  else
+    status = -1;
+  evutil_closesocket(fd);
+
+  return ( status == 0 );
+}
+
+/*
+ * Binds an HTTP instance on the specified unix domain socket path.
+ * Stale socket file left by previous process is removed.
+ * @param [String] path socket file path
+ * @param [Fixnum nil] mode socket file permissions (i.e 0660)
+ * @return [true] on success
+ * @return [false] on failure or if another process is listening on path
+ */
+static VALUE t_bind_unix_socket(VALUE self, VALUE path, VALUE mode) {
+  Libevent_Http *http;
+  struct sockaddr_un address;
+  struct stat st;
+  evutil_socket_t fd;
+
+  Data_Get_Struct(self, Libevent_Http, http);
+  Check_Type(path, T_STRING);
+  Libevent_Base_check_thread(http->base);
+
+  if ( RSTRING_LEN(path) >= (long)sizeof(address.sun_path) )
+    rb_raise(rb_eArgError, "unix socket path is too long");
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, RSTRING_PTR(path), RSTRING_LEN(path));
+
+  if ( lstat(address.sun_path, &st) == 0 && S_ISSOCK(st.st_mode) && !t_unlink_stale_socket(&address) )
+    return Qfalse;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ( fd == -1 )
+    return Qfalse;
+
+  if ( evutil_make_socket_closeonexec(fd) == -1 ||
+       evutil_make_socket_nonblocking(fd) == -1 ||
+       bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+       ( mode != Qnil && chmod(address.sun_path, NUM2INT(mode)) == -1 ) ||
+       listen(fd, 128) == -1 ||
+       evhttp_accept_socket(http->ev_http, fd) == -1 ) {
+    evutil_closesocket(fd);
+    return Qfalse;
+  }
+
+  if ( http->label[0] == '\0' )
+    snprintf(http->label, sizeof(http->label), "unix:%s", address.sun_path);
+
+  return Qtrue;
+}
+
+/*
+ * Makes an HTTP instance accept connections on already listening socket,
+ * i.e. inherited from parent process or passed by socket activation.
+ * @note
+ *   Fixnum descriptor is owned by http instance and will be closed with it.
+ *   IO descriptor is duplicated so IO object can be closed independently.
+ * @param [Fixnum IO] socket listening socket descriptor or IO instance
+ * @return [true] on success
+ * @return [false] on failure
+ */
+static VALUE t_accept_socket(VALUE self, VALUE socket) {
+  Libevent_Http *http;
+  evutil_socket_t fd;
+
+  Data_Get_Struct(self, Libevent_Http, http);
+  Libevent_Base_check_thread(http->base);
+
+  if ( FIXNUM_P(socket) ) {
+    fd = FIX2INT(socket);
+  } else if ( rb_respond_to(socket, rb_intern("fileno")) ) {
+    fd = dup(NUM2INT(rb_funcall(socket, rb_intern("fileno"), 0)));
+    if ( fd == -1 || evutil_make_socket_closeonexec(fd) == -1 )
+      return Qfalse;
+  } else {
+    rb_raise(rb_eTypeError, "socket should be Fixnum or IO instance");
+  }
+
+  if ( evutil_make_socket_nonblocking(fd) == -1 || evhttp_accept_socket(http->ev_http, fd) == -1 ) {
+    if ( !FIXNUM_P(socket) )
+      evutil_closesocket(fd);
+    return Qfalse;
+  }
+
+  return Qtrue;
+}
+
 /*
  * Set a callback for all requests that are not caught by specific callbacks.
  * @note
  *   handler should response to :call method.
  *
  *   Libevent::HttpRequest instance will be passed to handler as first argument
- *   
+ *
+ *   With :threads option handler is called by pool of Ruby threads so slow request
+ *   does not block event loop. Replies are passed back to event loop thread,
+ *   libevent is never called from handler threads.
+ *
+ * @overload set_request_handler(handler, options = {})
  * @param [Object] handler object that response to :call
+ * @param [Hash] options
+ * @option options [Fixnum] :threads number of handler threads (default 0, call handler in event loop)
  * @return [nil]
  */
-static VALUE t_set_request_handler(VALUE self, VALUE handler) {
+static VALUE t_set_request_handler(int argc, VALUE *argv, VALUE self) {
   Libevent_Http *http;
+  VALUE handler;
+  VALUE options;
+  VALUE threads = Qnil;
 
   Data_Get_Struct(self, Libevent_Http, http);
+  rb_scan_args(argc, argv, "11", &handler, &options);
 
   if ( !rb_respond_to(handler, rb_intern("call")))
     rb_raise(rb_eArgError, "handler does not response to call method");
 
+  if ( options != Qnil ) {
+    Check_Type(options, T_HASH);
+    threads = rb_hash_aref(options, ID2SYM(rb_intern("threads")));
+  }
+
+  if ( threads != Qnil && NUM2INT(threads) > 0 ) {
+    if ( !http->ev_reply_notify ) {
+      http->ev_reply_notify = event_new(http->ev_base, -1, 0, t_reply_notify, (void *)http);
+      if ( !http->ev_reply_notify )
+        rb_fatal("Could not create reply notification event");
+      if ( http->priority >= 0 )
+        event_priority_set(http->ev_reply_notify, http->priority);
+      pthread_mutex_init(&http->reply_mutex, NULL);
+    }
+    http->threads = NUM2INT(threads);
+    // handler is replaced by object that queues requests to worker threads
+    handler = rb_funcall(self, rb_intern("start_workers"), 2, handler, threads);
+  } else {
+    http->threads = 0;
+  }
+
+  // instance variable keeps handler from being garbage collected
   rb_iv_set(self, "@request_handler", handler);
-  evhttp_set_gencb(http->ev_http, t_request_handler, (void *)handler);
+  http->request_handler = handler;
+  evhttp_set_gencb(http->ev_http, t_request_handler, (void *)http);
 
   return Qnil;
 }
 
+typedef struct t_request_handler_args {
+  Libevent_Http *http;
+  struct evhttp_request *ev_request;
+} t_request_handler_args;
+
 /*
  * C callback function that create HttpRequest instance and call Ruby handler object with it.
  */
 static void t_request_handler(struct evhttp_request *ev_request, void* context) {
+  Libevent_Http *http = (Libevent_Http *)context;
+  t_request_handler_args args;
+
+  http->base->requests++;
+  evhttp_request_set_on_complete_cb(ev_request, t_request_complete, (void *)http);
+  // socket events are reassigned with default priority when evhttp sets connection fd:
+  // apply priority for the rest of connection (and own priority of virtual host)
+  if ( http->priority >= 0 )
+    bufferevent_priority_set(evhttp_connection_get_bufferevent(evhttp_request_get_connection(ev_request)), http->priority);
+  if ( http->base->draining )
+    evhttp_add_header(evhttp_request_get_output_headers(ev_request), "Connection", "close");
+
+  args.http = http;
+  args.ev_request = ev_request;
+  Libevent_Base_with_gvl(http->base, "http", http->label, evhttp_request_get_uri(ev_request), t_call_request_handler, (VALUE)&args);
+}
+
+static VALUE t_call_request_handler(VALUE context) {
+  t_request_handler_args *args = (t_request_handler_args *)context;
   Libevent_HttpRequest *le_http_request;
   VALUE http_request;
-  VALUE handler = (VALUE)context;
 
   http_request = rb_obj_alloc(cLibevent_HttpRequest);
   Data_Get_Struct(http_request, Libevent_HttpRequest, le_http_request);
-  le_http_request->ev_request = ev_request;
+  le_http_request->ev_request = args->ev_request;
+  le_http_request->access_log = args->http->access_log;
+  // log replaced by Http#set_access_log is kept until request is collected
+  if ( le_http_request->access_log )
+    Libevent_AccessLog_retain(le_http_request->access_log);
+  le_http_request->http = args->http;
+  le_http_request->threaded = ( args->http->threads > 0 );
+
+  if ( args->http->access_log )
+    gettimeofday(&le_http_request->start, NULL);
   rb_obj_call_init(http_request, 0, 0);
 
-  rb_funcall(handler, rb_intern("call"), 1, http_request);
+  return rb_funcall(args->http->request_handler, rb_intern("call"), 1, http_request);
+}
+
+/*
+ * Queue reply made by handler thread and wake up event loop. Thread safe.
+ */
+void Libevent_Http_queue_reply(Libevent_Http *http, Libevent_HttpReply *reply) {
+  reply->next = NULL;
+
+  pthread_mutex_lock(&http->reply_mutex);
+  if ( http->replies_tail )
+    http->replies_tail->next = reply;
+  else
+    http->replies = reply;
+  http->replies_tail = reply;
+  pthread_mutex_unlock(&http->reply_mutex);
+
+  event_active(http->ev_reply_notify, 0, 0);
+}
+
+/*
+ * C callback function that sends queued replies from event loop thread.
+ */
+static void t_reply_notify(evutil_socket_t fd, short events, void *context) {
+  Libevent_Http *http = (Libevent_Http *)context;
+  Libevent_HttpReply *reply;
+  Libevent_HttpReply *next;
+
+  pthread_mutex_lock(&http->reply_mutex);
+  reply = http->replies;
+  http->replies = NULL;
+  http->replies_tail = NULL;
+  pthread_mutex_unlock(&http->reply_mutex);
+
+  for ( ; reply; reply = next ) {
+    next = reply->next;
+
+    switch ( reply->type ) {
+      case LIBEVENT_REPLY_START:
+        evhttp_send_reply_start(reply->ev_request, reply->code, reply->reason);
+        break;
+      case LIBEVENT_REPLY_CHUNK:
+        evhttp_send_reply_chunk(reply->ev_request, reply->ev_buffer);
+        break;
+      case LIBEVENT_REPLY_END:
+        if ( reply->access_log )
+          Libevent_AccessLog_push(reply->access_log, reply->ev_request,
+              evhttp_request_get_response_code(reply->ev_request), reply->bytes, &reply->start);
+        evhttp_send_reply_end(reply->ev_request);
+        break;
+      case LIBEVENT_REPLY_ERROR:
+        if ( reply->access_log )
+          Libevent_AccessLog_push(reply->access_log, reply->ev_request, reply->code, reply->bytes, &reply->start);
+        evhttp_send_error(reply->ev_request, reply->code, reply->reason);
+        break;
+    }
+
+    if ( reply->access_log )
+      Libevent_AccessLog_release(reply->access_log);
+    if ( reply->ev_buffer )
+      evbuffer_free(reply->ev_buffer);
+    if ( reply->reason )
+      free(reply->reason);
+    free(reply);
+  }
+}
+
+/*
+ * C callback function invoked by libevent when reply is completely sent.
+ * Exits base loop when it is draining and last in-flight request is finished.
+ */
+static void t_request_complete(struct evhttp_request *ev_request, void *context) {
+  Libevent_Http_request_done((Libevent_Http *)context);
+}
+
+/*
+ * Account finished request (completely sent reply or upgraded connection)
+ */
+void Libevent_Http_request_done(Libevent_Http *http) {
+  http->base->requests--;
+
+  if ( http->base->draining && http->base->requests == 0 )
+    event_base_loopexit(http->ev_base, NULL);
 }
 
 /*
@@ -178,7 +576,134 @@ static VALUE t_add_virtual_host(VALUE self, VALUE domain, VALUE vhttp) {
   Check_Type(domain, T_STRING);
   le_vhttp->ev_http_parent = le_http->ev_http;
   status = evhttp_add_virtual_host(le_http->ev_http, RSTRING_PTR(domain), le_vhttp->ev_http);
+  snprintf(le_vhttp->label, sizeof(le_vhttp->label), "%s", RSTRING_PTR(domain));
 
   return ( status == -1 ? Qfalse : Qtrue );
 }
 
+/*
+ * Set priority of connections accepted by this http instance
+ * (or of requests routed to this virtual host) and of reply notifications of handler threads.
+ * Bind health check port on separate http instance with more urgent priority
+ * to serve it first when event loop is saturated.
+ *
+ * @note listeners keep default priority (priorities / 2), so bulk traffic should get
+ *   less urgent priority than default for new health check connections to be accepted first
+ *
+ * @param [Fixnum] priority event priority, see Base#init_priorities
+ * @return [nil]
+ * @raise [ArgumentError] if priority is out of range
+ */
+static VALUE t_set_priority(VALUE self, VALUE priority) {
+  Libevent_Http *http;
+
+  Data_Get_Struct(self, Libevent_Http, http);
+
+  if ( NUM2INT(priority) < 0 || NUM2INT(priority) >= event_base_get_npriorities(http->ev_base) )
+    rb_raise(rb_eArgError, "priority is out of range");
+
+  http->priority = NUM2INT(priority);
+  evhttp_set_bevcb(http->ev_http, t_bufferevent, (void *)http);
+  if ( http->ev_reply_notify )
+    event_priority_set(http->ev_reply_notify, http->priority);
+
+  return Qnil;
+}
+
+/*
+ * C callback function that creates bufferevent of accepted connection.
+ * Callbacks are deferred so request parsing and handler run with http priority
+ * from the first request, socket reads keep default priority.
+ */
+static struct bufferevent *t_bufferevent(struct event_base *ev_base, void *context) {
+  Libevent_Http *http = (Libevent_Http *)context;
+  struct bufferevent *ev_bufferevent;
+
+  ev_bufferevent = bufferevent_socket_new(ev_base, -1, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS);
+  if ( ev_bufferevent )
+    bufferevent_priority_set(ev_bufferevent, http->priority);
+
+  return ev_bufferevent;
+}
+
+/*
+ * Log every completed request of this http instance
+ * @param [AccessLog] access_log log instance or nil to disable logging
+ * @return [nil]
+ * @see AccessLog
+ */
+static VALUE t_set_access_log(VALUE self, VALUE access_log) {
+  Libevent_Http *http;
+  Libevent_AccessLog *log = NULL;
+
+  Data_Get_Struct(self, Libevent_Http, http);
+  if ( access_log != Qnil ) {
+    if ( !rb_obj_is_kind_of(access_log, cLibevent_AccessLog) )
+      rb_raise(rb_eTypeError, "access log should be Libevent::AccessLog instance");
+    Data_Get_Struct(access_log, Libevent_AccessLog, log);
+  }
+
+  rb_iv_set(self, "@access_log", access_log);
+  http->access_log = log;
+
+  return Qnil;
+}
+
+typedef struct t_bound_sockets {
+  struct evhttp_bound_socket **items;
+  int count;
+} t_bound_sockets;
+
+static void t_count_bound_socket(struct evhttp_bound_socket *bound_socket, void *context) {
+  ((t_bound_sockets *)context)->count++;
+}
+
+static void t_collect_bound_socket(struct evhttp_bound_socket *bound_socket, void *context) {
+  t_bound_sockets *bound_sockets = (t_bound_sockets *)context;
+
+  bound_sockets->items[bound_sockets->count++] = bound_socket;
+}
+
+static void t_collect_bound_socket_fd(struct evhttp_bound_socket *bound_socket, void *context) {
+  rb_ary_push((VALUE)context, INT2FIX(evhttp_bound_socket_get_fd(bound_socket)));
+}
+
+/*
+ * Get file descriptors of all listening sockets
+ * @return [Array<Fixnum>]
+ */
+static VALUE t_get_listener_fds(VALUE self) {
+  Libevent_Http *http;
+  VALUE fds = rb_ary_new();
+
+  Data_Get_Struct(self, Libevent_Http, http);
+  evhttp_foreach_bound_socket(http->ev_http, t_collect_bound_socket_fd, (void *)fds);
+
+  return fds;
+}
+
+/*
+ * Close all listening sockets. Connections that are already accepted are served as usual.
+ * @note sockets passed to another process (see Base#graceful_restart) stay open there
+ * @return [nil]
+ */
+static VALUE t_stop_accepting(VALUE self) {
+  Libevent_Http *http;
+  t_bound_sockets bound_sockets = { NULL, 0 };
+  int size;
+  int i;
+
+  Data_Get_Struct(self, Libevent_Http, http);
+  Libevent_Base_check_thread(http->base);
+
+  // collect first: evhttp_foreach_bound_socket does not allow removal while iterating
+  evhttp_foreach_bound_socket(http->ev_http, t_count_bound_socket, (void *)&bound_sockets);
+  size = bound_sockets.count;
+  bound_sockets.items = ALLOCA_N(struct evhttp_bound_socket *, size + 1);
+  bound_sockets.count = 0;
+  evhttp_foreach_bound_socket(http->ev_http, t_collect_bound_socket, (void *)&bound_sockets);
+  for ( i = 0; i < bound_sockets.count; i++ )
+    evhttp_del_accept_socket(http->ev_http, bound_sockets.items[i]);
+
+  return Qnil;
+}
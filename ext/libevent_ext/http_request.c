@@ -1,5 +1,15 @@
 #include "ext.h"
 
+#include <string.h>
+#include <strings.h>
+
+// header names are interned: frozen and shared by all requests
+#ifdef HAVE_RB_INTERNED_STR_CSTR
+#define HEADER_NAME(name) rb_interned_str_cstr(name)
+#else
+#define HEADER_NAME(name) rb_obj_freeze(rb_str_new2(name))
+#endif
+
 static VALUE t_allocate(VALUE klass);
 
 static void t_free(Libevent_HttpRequest *http_request);
@@ -26,8 +36,16 @@ static VALUE t_get_host(VALUE self);
 
 static VALUE t_get_input_headers(VALUE self);
 
+static VALUE t_get_header(VALUE self, VALUE name);
+
+static VALUE t_each_header(VALUE self);
+
 static VALUE t_get_body(VALUE self);
 
+static VALUE t_get_query_params(VALUE self);
+
+static VALUE t_get_form_params(VALUE self);
+
 static VALUE t_send_reply(VALUE self, VALUE code, VALUE headers, VALUE body);
 
 static VALUE t_send_error(VALUE self, VALUE code, VALUE reason);
@@ -46,6 +64,18 @@ static VALUE t_send_reply_chunk(VALUE self, VALUE chunk);
 
 static VALUE t_send_reply_end(VALUE self);
 
+static VALUE t_is_reply_started(VALUE self);
+
+static void t_log_request(Libevent_HttpRequest *http_request, int status);
+
+static void t_reply_start(Libevent_HttpRequest *http_request, int code, const char *reason);
+
+static void t_reply_chunk(Libevent_HttpRequest *http_request, VALUE chunk);
+
+static void t_reply_end(Libevent_HttpRequest *http_request);
+
+static void t_reply_error(Libevent_HttpRequest *http_request, int code, const char *reason);
+
 void Init_libevent_http_request() {
   cLibevent_HttpRequest = rb_define_class_under(mLibevent, "HttpRequest", rb_cObject);
 
@@ -62,7 +92,12 @@ void Init_libevent_http_request() {
   rb_define_method(cLibevent_HttpRequest, "get_uri_query", t_get_uri_query, 0);
   rb_define_method(cLibevent_HttpRequest, "get_host", t_get_host, 0);
   rb_define_method(cLibevent_HttpRequest, "get_input_headers", t_get_input_headers, 0);
+  rb_define_method(cLibevent_HttpRequest, "header", t_get_header, 1);
+  rb_define_method(cLibevent_HttpRequest, "[]", t_get_header, 1);
+  rb_define_method(cLibevent_HttpRequest, "each_header", t_each_header, 0);
   rb_define_method(cLibevent_HttpRequest, "get_body", t_get_body, 0);
+  rb_define_method(cLibevent_HttpRequest, "query_params", t_get_query_params, 0);
+  rb_define_method(cLibevent_HttpRequest, "form_params", t_get_form_params, 0);
   rb_define_method(cLibevent_HttpRequest, "add_output_header", t_add_output_header, 2);
   rb_define_method(cLibevent_HttpRequest, "set_output_headers", t_set_output_headers, 1);
   rb_define_method(cLibevent_HttpRequest, "clear_output_headers", t_clear_output_headers, 0);
@@ -71,6 +106,7 @@ void Init_libevent_http_request() {
   rb_define_method(cLibevent_HttpRequest, "send_reply_start", t_send_reply_start, 2);
   rb_define_method(cLibevent_HttpRequest, "send_reply_chunk", t_send_reply_chunk, 1);
   rb_define_method(cLibevent_HttpRequest, "send_reply_end", t_send_reply_end, 0);
+  rb_define_method(cLibevent_HttpRequest, "reply_started?", t_is_reply_started, 0);
 }
 
 /*
@@ -81,6 +117,12 @@ static VALUE t_allocate(VALUE klass) {
 
   http_request->ev_request = NULL;
   http_request->ev_buffer = evbuffer_new();
+  http_request->access_log = NULL;
+  http_request->http = NULL;
+  http_request->bytes = 0;
+  http_request->threaded = 0;
+  http_request->started = 0;
+  http_request->finished = 0;
 
   return Data_Wrap_Struct(klass, 0, t_free, http_request); 
 }
@@ -92,6 +134,8 @@ static void t_free(Libevent_HttpRequest *http_request) {
   if ( http_request->ev_buffer != NULL ) {
     evbuffer_free(http_request->ev_buffer);
   }
+  if ( http_request->access_log )
+    Libevent_AccessLog_release(http_request->access_log);
 
   xfree(http_request);
 }
@@ -190,12 +234,50 @@ static VALUE t_get_input_headers(VALUE self) {
   ev_headers = evhttp_request_get_input_headers(http_request->ev_request);
 
   for ( ev_header = ev_headers->tqh_first; ev_header; ev_header = ev_header->next.tqe_next ) {
-    rb_hash_aset(headers, rb_str_new2(ev_header->key), rb_str_new2(ev_header->value));
+    rb_hash_aset(headers, HEADER_NAME(ev_header->key), rb_str_new2(ev_header->value));
   }
 
   return headers;
 }
 
+/*
+ * Get single request input header without converting others
+ * @param [String] name case insensitive header name
+ * @return [String nil] first value of header
+ */
+static VALUE t_get_header(VALUE self, VALUE name) {
+  Libevent_HttpRequest *http_request;
+  const char *value;
+
+  Data_Get_Struct(self, Libevent_HttpRequest, http_request);
+
+  value = evhttp_find_header(evhttp_request_get_input_headers(http_request->ev_request), StringValueCStr(name));
+
+  return( value ? rb_str_new2(value) : Qnil );
+}
+
+/*
+ * Iterate request input headers in received order
+ * @yieldparam [String] name frozen header name
+ * @yieldparam [String] value
+ * @return [nil]
+ */
+static VALUE t_each_header(VALUE self) {
+  Libevent_HttpRequest *http_request;
+  struct evkeyvalq *ev_headers;
+  struct evkeyval *ev_header;
+
+  Data_Get_Struct(self, Libevent_HttpRequest, http_request);
+
+  ev_headers = evhttp_request_get_input_headers(http_request->ev_request);
+
+  for ( ev_header = ev_headers->tqh_first; ev_header; ev_header = ev_header->next.tqe_next ) {
+    rb_yield_values(2, HEADER_NAME(ev_header->key), rb_str_new2(ev_header->value));
+  }
+
+  return Qnil;
+}
+
 /*
  * Get the remote address of associated connection
  * @return [String] IP address
@@ -226,10 +308,10 @@ static VALUE t_get_remote_port(VALUE self) {
  */
 static VALUE t_get_http_version(VALUE self) {
   Libevent_HttpRequest *http_request;
-  char http_version[3];
+  char http_version[16];
 
   Data_Get_Struct(self, Libevent_HttpRequest, http_request);
-  sprintf(http_version, "HTTP/%d.%d", http_request->ev_request->major, http_request->ev_request->minor);
+  snprintf(http_version, sizeof(http_version), "HTTP/%d.%d", http_request->ev_request->major, http_request->ev_request->minor);
 
   return rb_str_new2(http_version);
 }
@@ -312,6 +394,60 @@ static VALUE t_get_body(VALUE self) {
   return body;
 }
 
+/*
+ * Parse query string, result is memoized
+ * @return [Hash] parameters, nested keys a[b] and a[] are parsed into Hash and Array
+ * @raise [RangeError] if there are too many parameters or key is too long
+ */
+static VALUE t_get_query_params(VALUE self) {
+  Libevent_HttpRequest *http_request;
+  ID id = rb_intern("@query_params");
+  const char *query;
+  VALUE params;
+
+  if ( rb_ivar_defined(self, id) )
+    return rb_ivar_get(self, id);
+
+  Data_Get_Struct(self, Libevent_HttpRequest, http_request);
+
+  query = evhttp_uri_get_query(http_request->ev_request->uri_elems);
+  params = ( query ? Libevent_parse_params(query, strlen(query)) : rb_hash_new() );
+  rb_ivar_set(self, id, params);
+
+  return params;
+}
+
+/*
+ * Parse application/x-www-form-urlencoded body from input buffer, result is memoized
+ * @return [Hash] parameters, empty if body has other content type
+ * @raise [RangeError] if there are too many parameters or key is too long
+ */
+static VALUE t_get_form_params(VALUE self) {
+  Libevent_HttpRequest *http_request;
+  ID id = rb_intern("@form_params");
+  const char *content_type;
+  struct evbuffer *ev_buffer;
+  size_t length;
+  VALUE params;
+
+  if ( rb_ivar_defined(self, id) )
+    return rb_ivar_get(self, id);
+
+  Data_Get_Struct(self, Libevent_HttpRequest, http_request);
+
+  content_type = evhttp_find_header(evhttp_request_get_input_headers(http_request->ev_request), "Content-Type");
+  ev_buffer = evhttp_request_get_input_buffer(http_request->ev_request);
+  length = evbuffer_get_length(ev_buffer);
+
+  if ( content_type && strncasecmp(content_type, "application/x-www-form-urlencoded", 33) == 0 && length > 0 )
+    params = Libevent_parse_params((const char *)evbuffer_pullup(ev_buffer, -1), length);
+  else
+    params = rb_hash_new();
+  rb_ivar_set(self, id, params);
+
+  return params;
+}
+
 /*
  * Send error to client
  *
@@ -324,7 +460,7 @@ static VALUE t_send_error(VALUE self, VALUE code, VALUE reason) {
 
   Data_Get_Struct(self, Libevent_HttpRequest, http_request);
 
-  evhttp_send_error(http_request->ev_request, FIX2INT(code), reason == Qnil ? NULL : RSTRING_PTR(reason));
+  t_reply_error(http_request, FIX2INT(code), reason == Qnil ? NULL : RSTRING_PTR(reason));
 
   return Qnil;
 }
@@ -345,9 +481,9 @@ static VALUE t_send_reply(VALUE self, VALUE code, VALUE headers, VALUE body) {
 
   t_set_output_headers(self, headers);
 
-  evhttp_send_reply_start(http_request->ev_request, FIX2INT(code), NULL);
+  t_reply_start(http_request, FIX2INT(code), NULL);
   rb_iterate(rb_each, body, t_send_chunk, self);
-  evhttp_send_reply_end(http_request->ev_request);
+  t_reply_end(http_request);
 
   return Qnil;
 }
@@ -363,8 +499,7 @@ static VALUE t_send_chunk(VALUE chunk, VALUE self) {
 
   Data_Get_Struct(self, Libevent_HttpRequest, http_request);
 
-  evbuffer_add(http_request->ev_buffer, RSTRING_PTR(chunk), RSTRING_LEN(chunk));
-  evhttp_send_reply_chunk(http_request->ev_request, http_request->ev_buffer);
+  t_reply_chunk(http_request, chunk);
 
   return Qnil;
 }
@@ -381,7 +516,7 @@ static VALUE t_send_reply_start(VALUE self, VALUE code, VALUE reason) {
   Data_Get_Struct(self, Libevent_HttpRequest, http_request);
   Check_Type(code, T_FIXNUM);
 
-  evhttp_send_reply_start(http_request->ev_request, FIX2INT(code), reason == Qnil ? NULL : RSTRING_PTR(reason));
+  t_reply_start(http_request, FIX2INT(code), reason == Qnil ? NULL : RSTRING_PTR(reason));
 
   return Qnil;
 }
@@ -396,8 +531,7 @@ static VALUE t_send_reply_chunk(VALUE self, VALUE chunk) {
 
   Data_Get_Struct(self, Libevent_HttpRequest, http_request);
 
-  evbuffer_add(http_request->ev_buffer, RSTRING_PTR(chunk), RSTRING_LEN(chunk));
-  evhttp_send_reply_chunk(http_request->ev_request, http_request->ev_buffer);
+  t_reply_chunk(http_request, chunk);
 
   return Qnil;
 }
@@ -410,11 +544,115 @@ static VALUE t_send_reply_end(VALUE self) {
   Libevent_HttpRequest *http_request;
 
   Data_Get_Struct(self, Libevent_HttpRequest, http_request);
-  evhttp_send_reply_end(http_request->ev_request);
+
+  t_reply_end(http_request);
 
   return Qnil;
 }
 
+/*
+ * Check whether reply status line is already sent (or queued by handler thread),
+ * after that error can't be sent and reply can only be ended
+ * @return [true false]
+ */
+static VALUE t_is_reply_started(VALUE self) {
+  Libevent_HttpRequest *http_request;
+
+  Data_Get_Struct(self, Libevent_HttpRequest, http_request);
+
+  return ( http_request->started ? Qtrue : Qfalse );
+}
+
+/*
+ * Queue access log record. Must be called before reply is finished
+ * because libevent may free request right after that.
+ */
+static void t_log_request(Libevent_HttpRequest *http_request, int status) {
+  if ( http_request->access_log )
+    Libevent_AccessLog_push(http_request->access_log, http_request->ev_request, status, http_request->bytes, &http_request->start);
+}
+
+/*
+ * Pass reply of request handled by handler thread to event loop thread.
+ * Access log record is queued by event loop thread as well.
+ */
+static void t_queue_reply(Libevent_HttpRequest *http_request, int type, int code, const char *reason, VALUE chunk) {
+  Libevent_HttpReply *reply;
+
+  if ( http_request->finished )
+    rb_raise(rb_eRuntimeError, "reply is already finished");
+
+  // allocated outside of Ruby heap: freed by event loop thread without GVL
+  reply = malloc(sizeof(Libevent_HttpReply));
+  if ( !reply )
+    rb_memerror();
+
+  reply->type = type;
+  reply->code = code;
+  reply->reason = reason ? strdup(reason) : NULL;
+  reply->ev_buffer = NULL;
+  reply->ev_request = http_request->ev_request;
+  reply->access_log = http_request->access_log;
+  if ( reply->access_log )
+    Libevent_AccessLog_retain(reply->access_log);
+  reply->start = http_request->start;
+  reply->bytes = http_request->bytes;
+
+  if ( chunk != Qnil ) {
+    reply->ev_buffer = evbuffer_new();
+    evbuffer_add(reply->ev_buffer, RSTRING_PTR(chunk), RSTRING_LEN(chunk));
+  }
+
+  if ( type == LIBEVENT_REPLY_END || type == LIBEVENT_REPLY_ERROR )
+    http_request->finished = 1;
+
+  Libevent_Http_queue_reply(http_request->http, reply);
+}
+
+static void t_reply_start(Libevent_HttpRequest *http_request, int code, const char *reason) {
+  http_request->started = 1;
+
+  if ( http_request->threaded ) {
+    t_queue_reply(http_request, LIBEVENT_REPLY_START, code, reason, Qnil);
+  } else {
+    Libevent_Base_check_thread(http_request->http->base);
+    evhttp_send_reply_start(http_request->ev_request, code, reason);
+  }
+}
+
+static void t_reply_chunk(Libevent_HttpRequest *http_request, VALUE chunk) {
+  Check_Type(chunk, T_STRING);
+  http_request->bytes += RSTRING_LEN(chunk);
+
+  if ( http_request->threaded ) {
+    t_queue_reply(http_request, LIBEVENT_REPLY_CHUNK, 0, NULL, chunk);
+  } else {
+    Libevent_Base_check_thread(http_request->http->base);
+    evbuffer_add(http_request->ev_buffer, RSTRING_PTR(chunk), RSTRING_LEN(chunk));
+    evhttp_send_reply_chunk(http_request->ev_request, http_request->ev_buffer);
+  }
+}
+
+static void t_reply_end(Libevent_HttpRequest *http_request) {
+  if ( http_request->threaded ) {
+    t_queue_reply(http_request, LIBEVENT_REPLY_END, 0, NULL, Qnil);
+  } else {
+    Libevent_Base_check_thread(http_request->http->base);
+    t_log_request(http_request, evhttp_request_get_response_code(http_request->ev_request));
+    evhttp_send_reply_end(http_request->ev_request);
+  }
+}
+
+static void t_reply_error(Libevent_HttpRequest *http_request, int code, const char *reason) {
+  if ( http_request->threaded ) {
+    t_queue_reply(http_request, LIBEVENT_REPLY_ERROR, code, reason, Qnil);
+  } else {
+    Libevent_Base_check_thread(http_request->http->base);
+    t_log_request(http_request, code);
+    evhttp_send_error(http_request->ev_request, code, reason);
+  }
+}
+
 /*
  * Get request URI scheme
  * @return [String] http or https
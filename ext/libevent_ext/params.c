@@ -0,0 +1,191 @@
+#include "ext.h"
+
+#include <string.h>
+
+#define PARAMS_MAX_DEPTH 32
+
+typedef struct t_segment {
+  const char *name;
+  long length;
+} t_segment;
+
+static int t_hex(char c) {
+  if ( c >= '0' && c <= '9' )
+    return c - '0';
+  if ( c >= 'a' && c <= 'f' )
+    return c - 'a' + 10;
+  if ( c >= 'A' && c <= 'F' )
+    return c - 'A' + 10;
+  return -1;
+}
+
+/*
+ * Percent-decode form component into destination, '+' is decoded as space.
+ * Invalid escapes are kept as is.
+ * @return [long] decoded length
+ */
+static long t_decode(const char *source, long length, char *destination) {
+  const char *end = source + length;
+  char *start = destination;
+  int high;
+  int low;
+
+  while ( source < end ) {
+    if ( *source == '+' ) {
+      *destination++ = ' ';
+      source++;
+    } else if ( *source == '%' && end - source > 2 && (high = t_hex(source[1])) >= 0 && (low = t_hex(source[2])) >= 0 ) {
+      *destination++ = (high << 4) | low;
+      source += 3;
+    } else {
+      *destination++ = *source++;
+    }
+  }
+
+  return destination - start;
+}
+
+static VALUE t_string(const char *data, long length) {
+  VALUE string = rb_str_new(data, length);
+
+#ifdef HAVE_RUBY_ENCODING_H
+  rb_enc_associate(string, rb_utf8_encoding());
+#endif
+
+  return string;
+}
+
+/*
+ * Split decoded key "a[b][]" to segments "a", "b", "" (empty segment appends to array).
+ * Key with unbalanced brackets is a plain key.
+ * @return [int] number of segments
+ */
+static int t_split_key(const char *key, long length, t_segment *segments) {
+  const char *end = key + length;
+  const char *bracket = memchr(key, '[', length);
+  const char *close;
+  int count = 1;
+
+  segments[0].name = key;
+  segments[0].length = length;
+
+  if ( !bracket || bracket == key )
+    return 1;
+
+  segments[0].length = bracket - key;
+  while ( bracket < end ) {
+    if ( *bracket != '[' || !(close = memchr(bracket, ']', end - bracket)) ) {
+      segments[0].length = length;
+      return 1;
+    }
+    if ( count == PARAMS_MAX_DEPTH )
+      rb_raise(rb_eRangeError, "parameter nesting is too deep");
+    segments[count].name = bracket + 1;
+    segments[count].length = close - bracket - 1;
+    count++;
+    bracket = close + 1;
+  }
+
+  return count;
+}
+
+/*
+ * Store value under nested key following Rack conventions:
+ * a[b]=1 is {"a" => {"b" => "1"}}, a[]=1 is {"a" => ["1"]},
+ * a[][b]=1&a[][b]=2 is {"a" => [{"b" => "1"}, {"b" => "2"}]}
+ */
+static void t_store(VALUE params, const char *key, long length, VALUE value) {
+  t_segment segments[PARAMS_MAX_DEPTH];
+  VALUE container = params;
+  VALUE child;
+  VALUE name;
+  VALUE last;
+  int count = t_split_key(key, length, segments);
+  int i = 0;
+
+  while ( 1 ) {
+    name = t_string(segments[i].name, segments[i].length);
+
+    if ( i == count - 1 ) {
+      rb_hash_aset(container, name, value);
+      return;
+    }
+
+    if ( segments[i + 1].length == 0 ) {
+      child = rb_hash_aref(container, name);
+      if ( TYPE(child) != T_ARRAY ) {
+        child = rb_ary_new();
+        rb_hash_aset(container, name, child);
+      }
+      if ( i + 1 == count - 1 ) {
+        rb_ary_push(child, value);
+        return;
+      }
+
+      // hash in array is reused until it gets repeated key
+      last = RARRAY_LEN(child) > 0 ? RARRAY_PTR(child)[RARRAY_LEN(child) - 1] : Qnil;
+      if ( TYPE(last) != T_HASH || RTEST(rb_funcall(last, rb_intern("key?"), 1, t_string(segments[i + 2].name, segments[i + 2].length))) ) {
+        last = rb_hash_new();
+        rb_ary_push(child, last);
+      }
+      container = last;
+      i += 2;
+    } else {
+      child = rb_hash_aref(container, name);
+      if ( TYPE(child) != T_HASH ) {
+        child = rb_hash_new();
+        rb_hash_aset(container, name, child);
+      }
+      container = child;
+      i++;
+    }
+  }
+}
+
+/*
+ * Parse query string or application/x-www-form-urlencoded body into Hash.
+ * Components are decoded in one pass, values are decoded straight into Ruby strings.
+ *
+ * @param [const char *] data
+ * @param [size_t] length
+ * @return [Hash] parameters, key without value is stored with nil
+ * @raise [RangeError] if there are more than LIBEVENT_PARAMS_MAX_COUNT parameters
+ *   or key is longer than LIBEVENT_PARAMS_MAX_KEY_SIZE
+ */
+VALUE Libevent_parse_params(const char *data, size_t length) {
+  VALUE params = rb_hash_new();
+  VALUE value;
+  char key[LIBEVENT_PARAMS_MAX_KEY_SIZE];
+  const char *end = data + length;
+  const char *pair_end;
+  const char *separator;
+  long key_length;
+  int count = 0;
+
+  while ( data < end ) {
+    for ( pair_end = data; pair_end < end && *pair_end != '&' && *pair_end != ';'; pair_end++ );
+    separator = memchr(data, '=', pair_end - data);
+    key_length = ( separator ? separator : pair_end ) - data;
+
+    if ( key_length > 0 ) {
+      if ( ++count > LIBEVENT_PARAMS_MAX_COUNT )
+        rb_raise(rb_eRangeError, "too many parameters");
+      if ( key_length > LIBEVENT_PARAMS_MAX_KEY_SIZE )
+        rb_raise(rb_eRangeError, "parameter key is too long");
+
+      key_length = t_decode(data, key_length, key);
+
+      value = Qnil;
+      if ( separator ) {
+        value = t_string(NULL, pair_end - separator - 1);
+        rb_str_set_len(value, t_decode(separator + 1, pair_end - separator - 1, RSTRING_PTR(value)));
+      }
+
+      t_store(params, key, key_length, value);
+    }
+
+    data = pair_end + 1;
+  }
+
+  return params;
+}
@@ -0,0 +1,332 @@
+#include "ext.h"
+
+#include <string.h>
+#include <time.h>
+
+static VALUE t_allocate(VALUE klass);
+
+static void t_mark(Libevent_Profiler *profiler);
+
+static void t_free(Libevent_Profiler *profiler);
+
+static VALUE t_initialize(VALUE self, VALUE base, VALUE threshold, VALUE sample);
+
+static VALUE t_detach(VALUE self);
+
+static VALUE t_reset(VALUE self);
+
+static VALUE t_get_current(VALUE self);
+
+static VALUE t_store_backtrace(VALUE self, VALUE id, VALUE backtrace);
+
+static VALUE t_get_stats(VALUE self);
+
+void Init_libevent_profiler() {
+  cLibevent_Profiler = rb_define_class_under(mLibevent, "Profiler", rb_cObject);
+
+  rb_define_alloc_func(cLibevent_Profiler, t_allocate);
+
+  rb_define_method(cLibevent_Profiler, "initialize", t_initialize, 3);
+  rb_define_method(cLibevent_Profiler, "detach", t_detach, 0);
+  rb_define_method(cLibevent_Profiler, "reset", t_reset, 0);
+  rb_define_method(cLibevent_Profiler, "current", t_get_current, 0);
+  rb_define_method(cLibevent_Profiler, "store_backtrace", t_store_backtrace, 2);
+  rb_define_method(cLibevent_Profiler, "stats", t_get_stats, 0);
+}
+
+static unsigned long long t_now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Allocate memory
+ */
+static VALUE t_allocate(VALUE klass) {
+  Libevent_Profiler *profiler = ALLOC(Libevent_Profiler);
+
+  profiler->base = NULL;
+  profiler->self = Qnil;
+  profiler->sample = 1;
+  profiler->calls = 0;
+  profiler->threshold = 0;
+  profiler->entries = NULL;
+  profiler->count = 0;
+  profiler->started = t_now();
+  profiler->busy = 0;
+  profiler->id = 0;
+  profiler->active = 0;
+  profiler->start = 0;
+  profiler->kind = NULL;
+  profiler->label = NULL;
+  profiler->detail[0] = '\0';
+  profiler->thread = Qnil;
+  profiler->backtrace = Qnil;
+
+  return Data_Wrap_Struct(klass, t_mark, t_free, profiler);
+}
+
+/*
+ * Mark loop thread and backtrace sampled from callback in progress
+ */
+static void t_mark(Libevent_Profiler *profiler) {
+  rb_gc_mark(profiler->thread);
+  rb_gc_mark(profiler->backtrace);
+}
+
+/*
+ * Free memory
+ */
+static void t_free(Libevent_Profiler *profiler) {
+  if ( profiler->base ) {
+    if ( profiler->base->profiler == profiler )
+      profiler->base->profiler = NULL;
+    Libevent_Base_release(profiler->base);
+  }
+
+  if ( profiler->entries )
+    xfree(profiler->entries);
+
+  xfree(profiler);
+}
+
+/*
+ * Start profiling Ruby callbacks of event base
+ *
+ * @note use Base#profile
+ * @param [Base] base
+ * @param [Numeric] threshold seconds, slower callbacks are passed to #slow_callback
+ * @param [Fixnum] sample profile every Nth callback
+ */
+static VALUE t_initialize(VALUE self, VALUE base, VALUE threshold, VALUE sample) {
+  Libevent_Profiler *profiler;
+  Libevent_Base *le_base;
+
+  Data_Get_Struct(self, Libevent_Profiler, profiler);
+  Data_Get_Struct(base, Libevent_Base, le_base);
+
+  if ( NUM2LONG(sample) < 1 )
+    rb_raise(rb_eArgError, "sample should be positive");
+
+  profiler->self = self;
+  profiler->sample = NUM2ULONG(sample);
+  profiler->threshold = (unsigned long long)(NUM2DBL(threshold) * 1000000);
+  profiler->entries = ALLOC_N(Libevent_ProfilerEntry, LIBEVENT_PROFILER_LABELS);
+  profiler->base = le_base;
+  Libevent_Base_retain(le_base);
+  le_base->profiler = profiler;
+
+  rb_iv_set(self, "@base", base);
+  rb_iv_set(self, "@threshold", threshold);
+  rb_iv_set(self, "@sample", sample);
+
+  return self;
+}
+
+/*
+ * Stop profiling callbacks, collected stats are kept
+ * @return [nil]
+ */
+static VALUE t_detach(VALUE self) {
+  Libevent_Profiler *profiler;
+
+  Data_Get_Struct(self, Libevent_Profiler, profiler);
+
+  if ( profiler->base->profiler == profiler )
+    profiler->base->profiler = NULL;
+
+  return Qnil;
+}
+
+/*
+ * Clear collected stats
+ * @return [nil]
+ */
+static VALUE t_reset(VALUE self) {
+  Libevent_Profiler *profiler;
+
+  Data_Get_Struct(self, Libevent_Profiler, profiler);
+
+  profiler->count = 0;
+  profiler->calls = 0;
+  profiler->busy = 0;
+  profiler->started = t_now();
+
+  return Qnil;
+}
+
+/*
+ * Get callback in progress, used by watchdog thread to sample backtrace of slow callback
+ * @return [Array nil] callback id, seconds elapsed and loop thread
+ */
+static VALUE t_get_current(VALUE self) {
+  Libevent_Profiler *profiler;
+
+  Data_Get_Struct(self, Libevent_Profiler, profiler);
+
+  if ( !profiler->active )
+    return Qnil;
+
+  return rb_ary_new3(3, ULONG2NUM(profiler->id), rb_float_new((t_now() - profiler->start) / 1e6), profiler->thread);
+}
+
+/*
+ * Attach backtrace to callback in progress
+ * @param [Fixnum] id callback id returned by #current
+ * @param [Array<String>] backtrace
+ * @return [nil]
+ */
+static VALUE t_store_backtrace(VALUE self, VALUE id, VALUE backtrace) {
+  Libevent_Profiler *profiler;
+
+  Data_Get_Struct(self, Libevent_Profiler, profiler);
+
+  if ( profiler->active && profiler->id == NUM2ULONG(id) )
+    profiler->backtrace = backtrace;
+
+  return Qnil;
+}
+
+/*
+ * Get collected stats
+ * @return [Hash] "elapsed" and "busy" seconds, number of "calls", "sample" rate and "callbacks" list
+ *   with "label", "count", "total", "max" seconds and "histogram" as [upper bound seconds, count] pairs
+ */
+static VALUE t_get_stats(VALUE self) {
+  Libevent_Profiler *profiler;
+  Libevent_ProfilerEntry *entry;
+  VALUE stats;
+  VALUE callbacks;
+  VALUE callback;
+  VALUE histogram;
+  int i;
+  int j;
+
+  Data_Get_Struct(self, Libevent_Profiler, profiler);
+
+  callbacks = rb_ary_new();
+  for ( i = 0; i < profiler->count; i++ ) {
+    entry = &profiler->entries[i];
+
+    histogram = rb_ary_new();
+    for ( j = 0; j < LIBEVENT_PROFILER_BUCKETS; j++ ) {
+      if ( entry->buckets[j] )
+        rb_ary_push(histogram, rb_ary_new3(2, rb_float_new((double)(2ULL << j) / 1e6), ULONG2NUM(entry->buckets[j])));
+    }
+
+    callback = rb_hash_new();
+    rb_hash_aset(callback, rb_str_new2("label"), rb_str_new2(entry->label));
+    rb_hash_aset(callback, rb_str_new2("count"), ULONG2NUM(entry->count));
+    rb_hash_aset(callback, rb_str_new2("total"), rb_float_new(entry->total / 1e6));
+    rb_hash_aset(callback, rb_str_new2("max"), rb_float_new(entry->max / 1e6));
+    rb_hash_aset(callback, rb_str_new2("histogram"), histogram);
+    rb_ary_push(callbacks, callback);
+  }
+
+  stats = rb_hash_new();
+  rb_hash_aset(stats, rb_str_new2("elapsed"), rb_float_new((t_now() - profiler->started) / 1e6));
+  rb_hash_aset(stats, rb_str_new2("busy"), rb_float_new(profiler->busy / 1e6));
+  rb_hash_aset(stats, rb_str_new2("calls"), ULONG2NUM(profiler->calls));
+  rb_hash_aset(stats, rb_str_new2("sample"), ULONG2NUM(profiler->sample));
+  rb_hash_aset(stats, rb_str_new2("callbacks"), callbacks);
+
+  return stats;
+}
+
+/*
+ * Find or add histogram entry of handler. Entries are keyed by address of handler label,
+ * label text is compared only on match in case address was reused by another handler.
+ * Labels over limit are counted as "other".
+ */
+static Libevent_ProfilerEntry *t_entry(Libevent_Profiler *profiler) {
+  Libevent_ProfilerEntry *entry;
+  char label[LIBEVENT_PROFILER_LABEL_MAX];
+  int i;
+
+  if ( profiler->label && profiler->label[0] )
+    snprintf(label, sizeof(label), "%s %s", profiler->kind, profiler->label);
+  else
+    snprintf(label, sizeof(label), "%s", profiler->kind);
+
+  for ( i = 0; i < profiler->count; i++ ) {
+    if ( profiler->entries[i].key == profiler->label && strcmp(profiler->entries[i].label, label) == 0 )
+      return &profiler->entries[i];
+  }
+
+  // last entry is reserved for labels over limit
+  if ( profiler->count == LIBEVENT_PROFILER_LABELS )
+    return &profiler->entries[LIBEVENT_PROFILER_LABELS - 1];
+  if ( profiler->count == LIBEVENT_PROFILER_LABELS - 1 )
+    strcpy(label, "other");
+
+  entry = &profiler->entries[profiler->count++];
+  memset(entry, 0, sizeof(Libevent_ProfilerEntry));
+  entry->key = profiler->label;
+  strcpy(entry->label, label);
+
+  return entry;
+}
+
+/*
+ * Timestamp callback entry, called with GVL
+ * @return [int] 1 if callback is sampled
+ */
+int Libevent_Profiler_enter(Libevent_Profiler *profiler, const char *kind, const char *label, const char *detail) {
+  // nested loop (dispatch called from callback) is profiled as part of outer callback
+  if ( profiler->active || profiler->calls++ % profiler->sample != 0 )
+    return 0;
+
+  profiler->id++;
+  profiler->active = 1;
+  profiler->kind = kind;
+  profiler->label = label;
+  snprintf(profiler->detail, sizeof(profiler->detail), "%s", detail ? detail : "");
+  profiler->thread = rb_thread_current();
+  profiler->backtrace = Qnil;
+  profiler->start = t_now();
+
+  return 1;
+}
+
+static VALUE t_call_slow_callback(VALUE context) {
+  Libevent_Profiler *profiler = (Libevent_Profiler *)context;
+  unsigned long long elapsed = t_now() - profiler->start;
+
+  return rb_funcall(profiler->self, rb_intern("slow_callback"), 4, rb_str_new2(profiler->kind),
+      rb_str_new2(profiler->detail), rb_float_new(elapsed / 1e6), profiler->backtrace);
+}
+
+/*
+ * Timestamp callback exit, record histogram and report slow callback
+ */
+void Libevent_Profiler_exit(Libevent_Profiler *profiler) {
+  Libevent_ProfilerEntry *entry;
+  unsigned long long elapsed = t_now() - profiler->start;
+  VALUE errinfo;
+  int bucket = 0;
+  int state = 0;
+
+  entry = t_entry(profiler);
+  while ( bucket < LIBEVENT_PROFILER_BUCKETS - 1 && (elapsed >> (bucket + 1)) > 0 )
+    bucket++;
+  entry->buckets[bucket]++;
+  entry->count++;
+  entry->total += elapsed;
+  if ( elapsed > entry->max )
+    entry->max = elapsed;
+  profiler->busy += elapsed;
+
+  // logging errors must not break the loop nor replace exception raised by callback
+  if ( profiler->threshold && elapsed >= profiler->threshold ) {
+    errinfo = rb_errinfo();
+    rb_protect(t_call_slow_callback, (VALUE)profiler, &state);
+    rb_set_errinfo(errinfo);
+  }
+
+  profiler->active = 0;
+  profiler->thread = Qnil;
+  profiler->backtrace = Qnil;
+}
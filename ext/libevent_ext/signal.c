@@ -4,18 +4,20 @@ static VALUE t_allocate(VALUE klass);
 
 static void t_free(Libevent_Signal *signal);
 
-static VALUE t_initialize(VALUE self, VALUE base, VALUE name, VALUE handler);
+static VALUE t_initialize(int argc, VALUE *argv, VALUE self);
 
 static VALUE t_destroy(VALUE self);
 
 static void t_handler(evutil_socket_t signal_number, short events, void *context);
 
+static VALUE t_call_handler(VALUE handler);
+
 void Init_libevent_signal() {
   cLibevent_Signal = rb_define_class_under(mLibevent, "Signal", rb_cObject);
   
   rb_define_alloc_func(cLibevent_Signal, t_allocate);
 
-  rb_define_method(cLibevent_Signal, "initialize", t_initialize, 3);
+  rb_define_method(cLibevent_Signal, "initialize", t_initialize, -1);
   rb_define_method(cLibevent_Signal, "destroy", t_destroy, 0);
 }
 
@@ -26,6 +28,11 @@ static VALUE t_allocate(VALUE klass) {
   Libevent_Signal *signal;
 
   signal = ALLOC(Libevent_Signal);
+  signal->ev_event = NULL;
+  signal->base = NULL;
+  signal->handler = Qnil;
+  signal->name[0] = '\0';
+
   return Data_Wrap_Struct(klass, 0, t_free, signal); 
 }
 
@@ -37,6 +44,9 @@ static void t_free(Libevent_Signal *signal) {
     event_free(signal->ev_event);
   }
 
+  if ( signal->base )
+    Libevent_Base_release(signal->base);
+
   xfree(signal);
 }
 
@@ -46,17 +56,24 @@ static void t_free(Libevent_Signal *signal) {
  * @note method allocates memory for <b>struct event </b>
  *   that will be freed when object will be freed by ruby' GC
  *
+ * @overload initialize(base, name, handler, priority = nil)
  * @param [Base] base event base instance
  * @param [String] name a name of signal
  * @param [Object] handler object that perform signal handling. Any object that responds to :call method
- *
+ * @param [Fixnum] priority event priority, see Base#init_priorities
+ * @raise [ArgumentError] if priority is out of range
  */
-static VALUE t_initialize(VALUE self, VALUE base, VALUE name, VALUE handler) {
+static VALUE t_initialize(int argc, VALUE *argv, VALUE self) {
   Libevent_Signal *le_signal;
   Libevent_Base *le_base;
+  VALUE base;
+  VALUE name;
+  VALUE handler;
+  VALUE priority;
   VALUE signal_list;
   VALUE signal_number;
 
+  rb_scan_args(argc, argv, "31", &base, &name, &handler, &priority);
   Data_Get_Struct(self, Libevent_Signal, le_signal);
   Data_Get_Struct(base, Libevent_Base, le_base);
 
@@ -66,16 +83,22 @@ static VALUE t_initialize(VALUE self, VALUE base, VALUE name, VALUE handler) {
   if ( signal_number == Qnil )
     rb_raise(rb_eArgError, "unknown signal name given");
   rb_iv_set(self, "@name", name);
+  snprintf(le_signal->name, sizeof(le_signal->name), "%s", StringValueCStr(name));
 
   // check handler
   if ( !rb_respond_to(handler, rb_intern("call")))
     rb_raise(rb_eArgError, "handler does not response to call method");
   rb_iv_set(self, "@handler", handler);
+  le_signal->handler = handler;
+  le_signal->base = le_base;
+  Libevent_Base_retain(le_base);
 
   // create signal event
-  le_signal->ev_event = evsignal_new(le_base->ev_base, FIX2INT(signal_number), t_handler, (void *)handler);
+  le_signal->ev_event = evsignal_new(le_base->ev_base, FIX2INT(signal_number), t_handler, (void *)le_signal);
   if ( !le_signal->ev_event )
     rb_fatal("Could not create a signal event");
+  if ( priority != Qnil && event_priority_set(le_signal->ev_event, NUM2INT(priority)) < 0 )
+    rb_raise(rb_eArgError, "priority is out of range");
   if ( event_add(le_signal->ev_event, NULL) < 0 )
     rb_fatal("Could not add a signal event");
 
@@ -101,7 +124,11 @@ static VALUE t_destroy(VALUE self) {
  * C callback function that invokes call method on  Ruby object.
  */
 static void t_handler(evutil_socket_t signal_number, short events, void *context) {
-  VALUE handler = (VALUE)context;
+  Libevent_Signal *le_signal = (Libevent_Signal *)context;
+
+  Libevent_Base_with_gvl(le_signal->base, "signal", le_signal->name, le_signal->name, t_call_handler, le_signal->handler);
+}
 
-  rb_funcall(handler, rb_intern("call"), 0);
+static VALUE t_call_handler(VALUE handler) {
+  return rb_funcall(handler, rb_intern("call"), 0);
 }
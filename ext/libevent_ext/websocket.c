@@ -0,0 +1,652 @@
+#include "ext.h"
+
+#include <string.h>
+#include <event2/bufferevent.h>
+
+#define WEBSOCKET_OPEN    0
+#define WEBSOCKET_CLOSING 1
+#define WEBSOCKET_CLOSED  2
+
+#define WEBSOCKET_CONTINUATION 0x0
+#define WEBSOCKET_TEXT         0x1
+#define WEBSOCKET_BINARY       0x2
+#define WEBSOCKET_CLOSE        0x8
+#define WEBSOCKET_PING         0x9
+#define WEBSOCKET_PONG         0xA
+
+#define WEBSOCKET_CLOSE_TIMEOUT 5
+
+static VALUE websockets;
+
+static VALUE t_allocate(VALUE klass);
+
+static void t_free(Libevent_WebSocket *websocket);
+
+static VALUE t_initialize(VALUE self, VALUE request, VALUE accept, VALUE protocol, VALUE max_message_size);
+
+static VALUE t_send_text(VALUE self, VALUE data);
+
+static VALUE t_send_binary(VALUE self, VALUE data);
+
+static VALUE t_ping(VALUE self, VALUE data);
+
+static VALUE t_close(int argc, VALUE *argv, VALUE self);
+
+static VALUE t_is_closed(VALUE self);
+
+static void t_read(struct bufferevent *ev_bufferevent, void *context);
+
+static void t_write(struct bufferevent *ev_bufferevent, void *context);
+
+static void t_event(struct bufferevent *ev_bufferevent, short events, void *context);
+
+static void t_connection_closed(struct evhttp_connection *ev_connection, void *context);
+
+void Init_libevent_websocket() {
+  cLibevent_WebSocket = rb_define_class_under(mLibevent, "WebSocket", rb_cObject);
+
+  // open websockets are referenced here so they are not collected while connected
+  websockets = rb_hash_new();
+  rb_global_variable(&websockets);
+
+  rb_define_alloc_func(cLibevent_WebSocket, t_allocate);
+
+  rb_define_method(cLibevent_WebSocket, "initialize", t_initialize, 4);
+  rb_define_method(cLibevent_WebSocket, "send_text", t_send_text, 1);
+  rb_define_method(cLibevent_WebSocket, "send_binary", t_send_binary, 1);
+  rb_define_method(cLibevent_WebSocket, "ping", t_ping, 1);
+  rb_define_method(cLibevent_WebSocket, "close", t_close, -1);
+  rb_define_method(cLibevent_WebSocket, "closed?", t_is_closed, 0);
+}
+
+/*
+ * Allocate memory
+ */
+static VALUE t_allocate(VALUE klass) {
+  Libevent_WebSocket *websocket = ALLOC(Libevent_WebSocket);
+
+  websocket->base = NULL;
+  websocket->ev_connection = NULL;
+  websocket->ev_bufferevent = NULL;
+  websocket->ev_message = NULL;
+  websocket->self = Qnil;
+  websocket->max_message_size = 0;
+  websocket->opcode = -1;
+  websocket->state = WEBSOCKET_CLOSED;
+  websocket->close_code = 1005;
+  websocket->close_reason[0] = '\0';
+
+  return Data_Wrap_Struct(klass, 0, t_free, websocket);
+}
+
+/*
+ * Free memory
+ * @note open websocket is not collected, but on exit it may be collected
+ *   before connection is released
+ */
+static void t_free(Libevent_WebSocket *websocket) {
+  if ( websocket->ev_connection ) {
+    evhttp_connection_set_closecb(websocket->ev_connection, NULL, NULL);
+    evhttp_connection_free(websocket->ev_connection);
+  }
+
+  if ( websocket->ev_message )
+    evbuffer_free(websocket->ev_message);
+
+  if ( websocket->base )
+    Libevent_Base_release(websocket->base);
+
+  xfree(websocket);
+}
+
+/*
+ * Send WebSocket handshake reply and take over request connection from evhttp
+ *
+ * @note use HttpRequest#upgrade_websocket
+ * @param [HttpRequest] request upgrade request
+ * @param [String] accept Sec-WebSocket-Accept value
+ * @param [String nil] protocol selected sub-protocol
+ * @param [Fixnum] max_message_size connection is closed with 1009 code when message is larger
+ * @raise [IOError] if request connection is already closed
+ */
+static VALUE t_initialize(VALUE self, VALUE request, VALUE accept, VALUE protocol, VALUE max_message_size) {
+  Libevent_WebSocket *websocket;
+  Libevent_HttpRequest *http_request;
+  struct evhttp_connection *ev_connection;
+  struct evbuffer *output;
+
+  Data_Get_Struct(self, Libevent_WebSocket, websocket);
+  Data_Get_Struct(request, Libevent_HttpRequest, http_request);
+  Check_Type(accept, T_STRING);
+
+  if ( http_request->threaded )
+    rb_raise(rb_eNotImpError, "websocket upgrade is supported only by event loop handler");
+  if ( http_request->finished )
+    rb_raise(rb_eRuntimeError, "reply is already finished");
+
+  ev_connection = evhttp_request_get_connection(http_request->ev_request);
+  if ( !ev_connection )
+    rb_raise(rb_eIOError, "connection is closed");
+
+  websocket->base = http_request->http->base;
+  Libevent_Base_retain(websocket->base);
+  websocket->ev_connection = ev_connection;
+  websocket->ev_bufferevent = evhttp_connection_get_bufferevent(ev_connection);
+  websocket->max_message_size = NUM2ULONG(max_message_size);
+  websocket->self = self;
+  websocket->state = WEBSOCKET_OPEN;
+
+  output = bufferevent_get_output(websocket->ev_bufferevent);
+  evbuffer_add_printf(output,
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: %s\r\n", RSTRING_PTR(accept));
+  if ( protocol != Qnil )
+    evbuffer_add_printf(output, "Sec-WebSocket-Protocol: %s\r\n", StringValueCStr(protocol));
+  evbuffer_add(output, "\r\n", 2);
+
+  // request is not going to be completed by evhttp
+  evhttp_request_set_on_complete_cb(http_request->ev_request, NULL, NULL);
+  if ( http_request->access_log )
+    Libevent_AccessLog_push(http_request->access_log, http_request->ev_request, 101, 0, &http_request->start);
+  Libevent_Http_request_done(http_request->http);
+  http_request->finished = 1;
+
+  // from now on evhttp only owns connection memory, all I/O goes through websocket
+  evhttp_connection_set_closecb(ev_connection, t_connection_closed, websocket);
+  bufferevent_set_timeouts(websocket->ev_bufferevent, NULL, NULL);
+  bufferevent_setcb(websocket->ev_bufferevent, t_read, t_write, t_event, websocket);
+  bufferevent_enable(websocket->ev_bufferevent, EV_READ | EV_WRITE);
+
+  // frames sent right after handshake are handled once handler set callbacks
+  if ( evbuffer_get_length(bufferevent_get_input(websocket->ev_bufferevent)) > 0 )
+    bufferevent_trigger(websocket->ev_bufferevent, EV_READ, BEV_TRIG_IGNORE_WATERMARKS | BEV_TRIG_DEFER_CALLBACKS);
+
+  rb_hash_aset(websockets, self, Qtrue);
+
+  return self;
+}
+
+/*
+ * Append unmasked frame to output buffer. Server frames are never masked.
+ */
+static void t_send_frame(Libevent_WebSocket *websocket, int opcode, const char *data, size_t length) {
+  unsigned char header[10];
+  size_t header_length;
+  struct evbuffer *output;
+  int i;
+
+  header[0] = 0x80 | opcode;
+  if ( length < 126 ) {
+    header[1] = length;
+    header_length = 2;
+  } else if ( length <= 0xffff ) {
+    header[1] = 126;
+    header[2] = (length >> 8) & 0xff;
+    header[3] = length & 0xff;
+    header_length = 4;
+  } else {
+    header[1] = 127;
+    for ( i = 0; i < 8; i++ )
+      header[2 + i] = ((unsigned long long)length >> (56 - 8 * i)) & 0xff;
+    header_length = 10;
+  }
+
+  output = bufferevent_get_output(websocket->ev_bufferevent);
+  evbuffer_add(output, header, header_length);
+  if ( length > 0 )
+    evbuffer_add(output, data, length);
+}
+
+/*
+ * Send close frame. Connection is released once peer replies or output is flushed.
+ */
+static void t_send_close(Libevent_WebSocket *websocket, int code, const char *reason, size_t length) {
+  char payload[125];
+
+  if ( length > sizeof(payload) - 2 )
+    length = sizeof(payload) - 2;
+  payload[0] = (code >> 8) & 0xff;
+  payload[1] = code & 0xff;
+  memcpy(payload + 2, reason, length);
+
+  t_send_frame(websocket, WEBSOCKET_CLOSE, payload, code == 1005 ? 0 : length + 2);
+}
+
+static void t_check_open(Libevent_WebSocket *websocket) {
+  if ( websocket->state != WEBSOCKET_OPEN )
+    rb_raise(rb_eIOError, "websocket is closed");
+  Libevent_Base_check_thread(websocket->base);
+}
+
+/*
+ * Send text message
+ * @param [String] data UTF-8 text
+ * @return [nil]
+ */
+static VALUE t_send_text(VALUE self, VALUE data) {
+  Libevent_WebSocket *websocket;
+
+  Data_Get_Struct(self, Libevent_WebSocket, websocket);
+  Check_Type(data, T_STRING);
+  t_check_open(websocket);
+  t_send_frame(websocket, WEBSOCKET_TEXT, RSTRING_PTR(data), RSTRING_LEN(data));
+
+  return Qnil;
+}
+
+/*
+ * Send binary message
+ * @param [String] data
+ * @return [nil]
+ */
+static VALUE t_send_binary(VALUE self, VALUE data) {
+  Libevent_WebSocket *websocket;
+
+  Data_Get_Struct(self, Libevent_WebSocket, websocket);
+  Check_Type(data, T_STRING);
+  t_check_open(websocket);
+  t_send_frame(websocket, WEBSOCKET_BINARY, RSTRING_PTR(data), RSTRING_LEN(data));
+
+  return Qnil;
+}
+
+/*
+ * Send ping. Pong reply is handled internally.
+ * @param [String] data application data up to 125 bytes
+ * @return [nil]
+ */
+static VALUE t_ping(VALUE self, VALUE data) {
+  Libevent_WebSocket *websocket;
+
+  Data_Get_Struct(self, Libevent_WebSocket, websocket);
+  Check_Type(data, T_STRING);
+  t_check_open(websocket);
+  if ( RSTRING_LEN(data) > 125 )
+    rb_raise(rb_eArgError, "ping data is too long");
+  t_send_frame(websocket, WEBSOCKET_PING, RSTRING_PTR(data), RSTRING_LEN(data));
+
+  return Qnil;
+}
+
+/*
+ * Start closing handshake
+ * @overload close(code = 1000, reason = "")
+ * @param [Fixnum] code close status code
+ * @param [String] reason
+ * @return [nil]
+ */
+static VALUE t_close(int argc, VALUE *argv, VALUE self) {
+  Libevent_WebSocket *websocket;
+  VALUE code;
+  VALUE reason;
+  struct timeval timeout = { WEBSOCKET_CLOSE_TIMEOUT, 0 };
+
+  Data_Get_Struct(self, Libevent_WebSocket, websocket);
+  rb_scan_args(argc, argv, "02", &code, &reason);
+
+  if ( websocket->state != WEBSOCKET_OPEN )
+    return Qnil;
+  Libevent_Base_check_thread(websocket->base);
+
+  if ( reason != Qnil )
+    Check_Type(reason, T_STRING);
+  t_send_close(websocket, code == Qnil ? 1000 : NUM2INT(code),
+      reason == Qnil ? "" : RSTRING_PTR(reason), reason == Qnil ? 0 : RSTRING_LEN(reason));
+
+  // wait for peer close frame, but not forever
+  websocket->state = WEBSOCKET_CLOSING;
+  bufferevent_set_timeouts(websocket->ev_bufferevent, &timeout, &timeout);
+
+  return Qnil;
+}
+
+/*
+ * @return [true false] true if closing handshake is started or connection is closed
+ */
+static VALUE t_is_closed(VALUE self) {
+  Libevent_WebSocket *websocket;
+
+  Data_Get_Struct(self, Libevent_WebSocket, websocket);
+
+  return ( websocket->state == WEBSOCKET_OPEN ? Qfalse : Qtrue );
+}
+
+static void *t_forget(void *context) {
+  rb_hash_delete(websockets, ((Libevent_WebSocket *)context)->self);
+
+  return NULL;
+}
+
+/*
+ * Release connection: evhttp frees bufferevent and closes socket.
+ * Called from event loop without GVL. Websocket can be collected from now on.
+ */
+static void t_release(Libevent_WebSocket *websocket) {
+  struct evhttp_connection *ev_connection = websocket->ev_connection;
+
+  websocket->state = WEBSOCKET_CLOSED;
+  websocket->ev_connection = NULL;
+  websocket->ev_bufferevent = NULL;
+
+  if ( ev_connection ) {
+    evhttp_connection_set_closecb(ev_connection, NULL, NULL);
+    evhttp_connection_free(ev_connection);
+  }
+
+#ifdef HAVE_RUBY_THREAD_H
+  rb_thread_call_with_gvl(t_forget, websocket);
+#else
+  t_forget(websocket);
+#endif
+}
+
+static VALUE t_call_message(VALUE context) {
+  Libevent_WebSocket *websocket = (Libevent_WebSocket *)context;
+  size_t length = evbuffer_get_length(websocket->ev_message);
+  VALUE handler;
+  VALUE message;
+
+  message = rb_str_new((char *)evbuffer_pullup(websocket->ev_message, length), length);
+  evbuffer_drain(websocket->ev_message, length);
+#ifdef HAVE_RUBY_ENCODING_H
+  if ( websocket->opcode == WEBSOCKET_TEXT )
+    rb_enc_associate(message, rb_utf8_encoding());
+#endif
+
+  handler = rb_iv_get(websocket->self, "@on_message");
+  if ( handler != Qnil )
+    rb_funcall(handler, rb_intern("call"), 2, message, websocket->opcode == WEBSOCKET_BINARY ? Qtrue : Qfalse);
+
+  return Qnil;
+}
+
+static VALUE t_call_close(VALUE context) {
+  Libevent_WebSocket *websocket = (Libevent_WebSocket *)context;
+  VALUE handler;
+
+  handler = rb_iv_get(websocket->self, "@on_close");
+  if ( handler != Qnil )
+    rb_funcall(handler, rb_intern("call"), 2, INT2FIX(websocket->close_code), rb_str_new2(websocket->close_reason));
+
+  return Qnil;
+}
+
+/*
+ * Connection is done: notify Ruby once and release connection,
+ * immediately or after pending output is flushed
+ */
+static void t_finish(Libevent_WebSocket *websocket, int flush) {
+  struct timeval timeout = { WEBSOCKET_CLOSE_TIMEOUT, 0 };
+  int state = websocket->state;
+
+  websocket->state = WEBSOCKET_CLOSED;
+  if ( state != WEBSOCKET_CLOSED )
+    Libevent_Base_with_gvl(websocket->base, "websocket", "close", "close", t_call_close, (VALUE)websocket);
+
+  if ( !flush || !websocket->ev_bufferevent || evbuffer_get_length(bufferevent_get_output(websocket->ev_bufferevent)) == 0 )
+    t_release(websocket);
+  else {
+    // peer that stops reading does not hold connection forever
+    bufferevent_disable(websocket->ev_bufferevent, EV_READ);
+    bufferevent_set_timeouts(websocket->ev_bufferevent, NULL, &timeout);
+  }
+}
+
+/*
+ * Fail connection with close code
+ */
+static void t_fail(Libevent_WebSocket *websocket, int code, const char *reason) {
+  if ( websocket->state == WEBSOCKET_OPEN )
+    t_send_close(websocket, code, reason, strlen(reason));
+  websocket->close_code = code;
+  snprintf(websocket->close_reason, sizeof(websocket->close_reason), "%s", reason);
+  t_finish(websocket, 1);
+}
+
+/*
+ * Unmask payload in place starting at offset
+ */
+static void t_unmask(struct evbuffer *buffer, size_t offset, size_t length, const unsigned char *mask) {
+  struct evbuffer_ptr position;
+  struct evbuffer_iovec *vectors;
+  size_t index = 0;
+  size_t i;
+  int count;
+  int n;
+
+  if ( length == 0 )
+    return;
+
+  evbuffer_ptr_set(buffer, &position, offset, EVBUFFER_PTR_SET);
+  count = evbuffer_peek(buffer, length, &position, NULL, 0);
+  vectors = alloca(sizeof(struct evbuffer_iovec) * count);
+  evbuffer_peek(buffer, length, &position, vectors, count);
+
+  for ( n = 0; n < count && index < length; n++ ) {
+    unsigned char *data = vectors[n].iov_base;
+    for ( i = 0; i < vectors[n].iov_len && index < length; i++, index++ )
+      data[i] ^= mask[index & 3];
+  }
+}
+
+/*
+ * Check that text message is well-formed UTF-8: no overlong forms,
+ * surrogates or code points above U+10FFFF
+ */
+static int t_valid_utf8(const unsigned char *data, size_t length) {
+  const unsigned char *end = data + length;
+  unsigned int code;
+  unsigned int minimum;
+  int count;
+
+  while ( data < end ) {
+    if ( *data < 0x80 ) {
+      data++;
+      continue;
+    }
+
+    if ( (*data & 0xe0) == 0xc0 ) {
+      code = *data & 0x1f;
+      minimum = 0x80;
+      count = 1;
+    } else if ( (*data & 0xf0) == 0xe0 ) {
+      code = *data & 0x0f;
+      minimum = 0x800;
+      count = 2;
+    } else if ( (*data & 0xf8) == 0xf0 ) {
+      code = *data & 0x07;
+      minimum = 0x10000;
+      count = 3;
+    } else {
+      return 0;
+    }
+
+    if ( end - data <= count )
+      return 0;
+    for ( data++; count > 0; count--, data++ ) {
+      if ( (*data & 0xc0) != 0x80 )
+        return 0;
+      code = (code << 6) | (*data & 0x3f);
+    }
+
+    if ( code < minimum || (code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff )
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Handle complete control frame
+ */
+static void t_control_frame(Libevent_WebSocket *websocket, int opcode, char *payload, size_t length) {
+  switch ( opcode ) {
+    case WEBSOCKET_PING:
+      if ( websocket->state == WEBSOCKET_OPEN )
+        t_send_frame(websocket, WEBSOCKET_PONG, payload, length);
+      break;
+    case WEBSOCKET_PONG:
+      break;
+    case WEBSOCKET_CLOSE:
+      if ( length == 1 ) {
+        t_fail(websocket, 1002, "invalid close frame");
+        return;
+      }
+      if ( length >= 2 ) {
+        websocket->close_code = ((unsigned char)payload[0] << 8) | (unsigned char)payload[1];
+        snprintf(websocket->close_reason, sizeof(websocket->close_reason), "%.*s", (int)(length - 2), payload + 2);
+      }
+      // reply to peer initiated close with the same code
+      if ( websocket->state == WEBSOCKET_OPEN )
+        t_send_frame(websocket, WEBSOCKET_CLOSE, payload, length >= 2 ? 2 : 0);
+      t_finish(websocket, 1);
+      break;
+  }
+}
+
+/*
+ * C callback function that parses frames from client.
+ * Ruby is called only when complete message is assembled.
+ */
+static void t_read(struct bufferevent *ev_bufferevent, void *context) {
+  Libevent_WebSocket *websocket = (Libevent_WebSocket *)context;
+  struct evbuffer *input = bufferevent_get_input(ev_bufferevent);
+  unsigned char header[14];
+  unsigned char *mask;
+  char control[125];
+  unsigned long long length;
+  size_t available;
+  size_t offset;
+  size_t message_length;
+  int fin;
+  int opcode;
+  int i;
+
+  while ( websocket->state != WEBSOCKET_CLOSED ) {
+    available = evbuffer_get_length(input);
+    if ( available < 2 )
+      return;
+
+    evbuffer_copyout(input, header, available < sizeof(header) ? available : sizeof(header));
+    fin = header[0] & 0x80;
+    opcode = header[0] & 0x0f;
+    length = header[1] & 0x7f;
+    offset = 2;
+
+    if ( header[0] & 0x70 ) {
+      t_fail(websocket, 1002, "reserved bits are set");
+      return;
+    }
+    if ( !(header[1] & 0x80) ) {
+      t_fail(websocket, 1002, "client frame is not masked");
+      return;
+    }
+
+    if ( length == 126 ) {
+      if ( available < 4 )
+        return;
+      length = (header[2] << 8) | header[3];
+      offset = 4;
+    } else if ( length == 127 ) {
+      if ( available < 10 )
+        return;
+      for ( length = 0, i = 0; i < 8; i++ )
+        length = (length << 8) | header[2 + i];
+      offset = 10;
+    }
+    if ( available < offset + 4 )
+      return;
+    mask = header + offset;
+    offset += 4;
+
+    if ( opcode >= WEBSOCKET_CLOSE ) {
+      if ( !fin || length > 125 || opcode > WEBSOCKET_PONG ) {
+        t_fail(websocket, 1002, "invalid control frame");
+        return;
+      }
+    } else if ( opcode > WEBSOCKET_BINARY ) {
+      t_fail(websocket, 1002, "unknown opcode");
+      return;
+    } else if ( (opcode == WEBSOCKET_CONTINUATION) != (websocket->opcode != -1) ) {
+      t_fail(websocket, 1002, "unexpected continuation frame");
+      return;
+    }
+
+    message_length = ( opcode == WEBSOCKET_CONTINUATION ? evbuffer_get_length(websocket->ev_message) : 0 );
+    if ( length > websocket->max_message_size || message_length + length > websocket->max_message_size ) {
+      t_fail(websocket, 1009, "message is too big");
+      return;
+    }
+
+    if ( available < offset + length )
+      return;
+    evbuffer_drain(input, offset);
+
+    if ( opcode >= WEBSOCKET_CLOSE ) {
+      evbuffer_remove(input, control, length);
+      for ( i = 0; i < (int)length; i++ )
+        control[i] ^= mask[i & 3];
+      t_control_frame(websocket, opcode, control, length);
+      continue;
+    }
+
+    // data frame: payload is moved to message buffer and unmasked there
+    if ( !websocket->ev_message )
+      websocket->ev_message = evbuffer_new();
+    if ( opcode != WEBSOCKET_CONTINUATION )
+      websocket->opcode = opcode;
+    evbuffer_remove_buffer(input, websocket->ev_message, length);
+    t_unmask(websocket->ev_message, message_length, length, mask);
+
+    if ( fin ) {
+      message_length = evbuffer_get_length(websocket->ev_message);
+      if ( websocket->opcode == WEBSOCKET_TEXT && !t_valid_utf8(evbuffer_pullup(websocket->ev_message, message_length), message_length) ) {
+        evbuffer_drain(websocket->ev_message, message_length);
+        websocket->opcode = -1;
+        t_fail(websocket, 1007, "invalid UTF-8 text");
+        return;
+      }
+      if ( websocket->state == WEBSOCKET_OPEN )
+        Libevent_Base_with_gvl(websocket->base, "websocket", "message", "message", t_call_message, (VALUE)websocket);
+      else
+        evbuffer_drain(websocket->ev_message, evbuffer_get_length(websocket->ev_message));
+      websocket->opcode = -1;
+    }
+  }
+}
+
+/*
+ * C callback function invoked when output is flushed.
+ * Releases connection after close frame is sent.
+ */
+static void t_write(struct bufferevent *ev_bufferevent, void *context) {
+  Libevent_WebSocket *websocket = (Libevent_WebSocket *)context;
+
+  if ( websocket->state == WEBSOCKET_CLOSED )
+    t_release(websocket);
+}
+
+/*
+ * C callback function invoked on EOF, error or close timeout
+ */
+static void t_event(struct bufferevent *ev_bufferevent, short events, void *context) {
+  Libevent_WebSocket *websocket = (Libevent_WebSocket *)context;
+
+  // closing handshake is not completed
+  if ( websocket->state != WEBSOCKET_CLOSED )
+    websocket->close_code = 1006;
+  t_finish(websocket, 0);
+}
+
+/*
+ * C callback function invoked when evhttp frees connection (i.e. http server is freed)
+ */
+static void t_connection_closed(struct evhttp_connection *ev_connection, void *context) {
+  Libevent_WebSocket *websocket = (Libevent_WebSocket *)context;
+
+  websocket->state = WEBSOCKET_CLOSED;
+  websocket->ev_connection = NULL;
+  websocket->ev_bufferevent = NULL;
+}
@@ -6,4 +6,8 @@ require "libevent/base"
 require "libevent/signal"
 require "libevent/http"
 require "libevent/http_request"
+require "libevent/access_log"
+require "libevent/websocket"
+require "libevent/broadcast"
+require "libevent/profiler"
 require "libevent/builder"
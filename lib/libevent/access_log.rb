@@ -0,0 +1,5 @@
+module Libevent
+  class AccessLog
+    attr_reader :path
+  end
+end
@@ -1,17 +1,87 @@
+require "rbconfig"
+
 module Libevent
   class Base
+    # Environment variable used to pass listening sockets to restarted process
+    LISTEN_FDS_ENV = "LIBEVENT_LISTEN_FDS"
+
+    # Command line of current process as of loading libevent.
+    # ARGV may already be consumed by option parser at that time (i.e. under rackup),
+    # pass :restart_command to Base.new in that case
+    RESTART_COMMAND = [RbConfig.ruby, $0, *ARGV].freeze
+
     # Create new event base
-    def initialize
+    # @param [Hash] options
+    # @option options [Fixnum] :priorities number of event priorities (see #init_priorities)
+    # @option options [Fixnum] :max_dispatch_callbacks check for new events after that many callbacks
+    #   of priority 1 and less urgent, so priority 0 events are not queued behind bulk work
+    # @option options [Array<String>] :restart_command (RESTART_COMMAND) command line used by #graceful_restart
+    def initialize(options = {})
       @signals = []
+      @https = []
+      @restart_command = options[:restart_command] || RESTART_COMMAND
+      configure(options[:max_dispatch_callbacks]) if options[:max_dispatch_callbacks]
+      init_priorities(options[:priorities]) or raise ArgumentError, "can't init priorities" if options[:priorities]
     end
 
     attr_reader :signals
 
+    # @return [Array<String>] command line of process started by #graceful_restart
+    attr_accessor :restart_command
+
+    # Http instances created with this event base
+    attr_reader :https
+
+    # @return [Profiler nil] active or last profiler
+    attr_reader :profiler
+
+    # Start profiling Ruby callbacks (http handlers, signals, websockets)
+    # @param [Hash] options
+    # @option options [Numeric] :threshold (0.1) seconds, slower callbacks are logged with backtrace
+    # @option options [Fixnum] :sample (1) profile every Nth callback
+    # @option options [IO Logger nil] :log (STDERR) destination of slow callback reports
+    # @option options [Boolean] :backtraces (true) sample backtrace of slow callbacks from watchdog thread
+    # @return [Profiler]
+    def profile(options = {})
+      @profiler.stop if @profiler
+      @profiler = Profiler.new(self, options[:threshold] || 0.1, options[:sample] || 1)
+      @profiler.log = options.fetch(:log, STDERR)
+      @profiler.start_watchdog if options.fetch(:backtraces, true)
+      @profiler
+    end
+
     # Create new signal with handler as block and add signal to event base
     #
     # @param [String] name of signal
-    def trap_signal(name, &block)
-      @signals << Signal.new(self, name, block)
+    # @param [Fixnum] priority event priority
+    def trap_signal(name, priority = nil, &block)
+      @signals << Signal.new(self, name, block, priority)
+    end
+
+    # Stop accepting new connections and exit loop when in-flight requests are finished
+    # @param [Numeric] timeout max seconds to wait for in-flight requests
+    def graceful_stop(timeout = 30)
+      https.each { |http| http.stop_accepting }
+      graceful_exit(timeout)
+    end
+
+    # Start new copy of current process passing it listening sockets
+    # then stop gracefully.
+    #
+    # New process picks up sockets with Http#inherit_socket.
+    # @param [Numeric] timeout max seconds to wait for in-flight requests
+    # @param [Array<String>] command command line of new process
+    # @return [Fixnum] pid of new process
+    def graceful_restart(timeout = 30, command = restart_command)
+      fds = https.map { |http| http.listener_fds }.flatten
+      options = { :chdir => Dir.pwd }
+      fds.each { |fd| options[fd] = fd }
+
+      pid = Process.spawn({ LISTEN_FDS_ENV => fds.join(",") }, *(command + [options]))
+      Process.detach(pid)
+
+      graceful_stop(timeout)
+      pid
     end
 
   end
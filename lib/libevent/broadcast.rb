@@ -0,0 +1,5 @@
+module Libevent
+  class Broadcast
+    attr_reader :base
+  end
+end
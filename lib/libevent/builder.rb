@@ -1,27 +1,30 @@
 module Libevent
   class Builder
     def initialize(options = {}, &block)
-      @base = Base.new
+      @base = Base.new(options)
       instance_eval(&block) if block_given?
     end
 
     attr_reader :base
 
-    # Create new Http instance, bind socket and options yield http object
+    # Create new Http instance, bind (or inherit on graceful restart) socket and options yield http object
     # @param [String] host
     # @param [Fixnum] port
+    # @param [Hash] options listening socket options (see Http#bind_socket) and :priority of connections
     # @return [Http] instance
-    def server(host, port, &block)
+    def server(host, port, options = nil, &block)
       http = Http.new(@base)
-      http.bind_socket(host, port) or raise RuntimeError, "can't bind socket #{host}:#{port}"
+      http.set_priority(options[:priority]) if options && options[:priority]
+      http.inherit_socket(host, port) or http.bind_socket(host, port, options) or raise RuntimeError, "can't bind socket #{host}:#{port}"
       yield(http) if block_given?
       http
     end
 
     # Trap signal using event base
     # @param [String] name a signal name
-    def signal(name, &block)
-      base.trap_signal(name, &block)
+    # @param [Fixnum] priority event priority
+    def signal(name, priority = nil, &block)
+      base.trap_signal(name, priority, &block)
     end
 
     # Start event base loop
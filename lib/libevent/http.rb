@@ -1,8 +1,42 @@
+require "socket"
+require "thread"
+
 module Libevent
   class Http
 
     attr_reader :base
 
+    # Listening sockets passed by parent process on graceful restart
+    # @return [Array<Socket>]
+    def self.inherited_sockets
+      @inherited_sockets ||= ENV.delete(Base::LISTEN_FDS_ENV).to_s.split(",").map do |fd|
+        Socket.for_fd(fd.to_i)
+      end
+    end
+
+    # Accept connections on socket inherited from parent process
+    # (see Base#graceful_restart) that is bound to the same address and port or unix path
+    # @param [String] address IP address, host name or unix socket path
+    # @param [Fixnum] port port (nil for unix socket)
+    # @return [true false] true if socket was found
+    def inherit_socket(address, port = nil)
+      ip_addresses = port ? resolve_bind_address(address, port) : []
+      socket = self.class.inherited_sockets.find do |s|
+        local = s.local_address
+        if port
+          local.ip? && local.ip_port == port.to_i && ip_addresses.include?(local.ip_address)
+        else
+          local.unix? && local.unix_path == address
+        end
+      end
+      return false unless socket
+
+      self.class.inherited_sockets.delete(socket)
+      accept_socket(socket) or return false
+      socket.close
+      true
+    end
+
     # Create virtual http server
     # @param [String] domain a domain for virtual server
     # @return [Http] http instance
@@ -13,11 +47,74 @@ module Libevent
       http
     end
 
+    # Start pool of threads that call handler for queued requests.
+    # Used by #set_request_handler with :threads option.
+    # @param [Object] handler object that response to :call
+    # @param [Fixnum] count number of threads
+    # @return [#call] object that queues request for threads
+    def start_workers(handler, count)
+      queue = Queue.new
+      @workers = Array.new(count) do
+        Thread.new do
+          while request = queue.pop
+            begin
+              handler.call(request)
+            rescue StandardError => e
+              STDERR.puts "#{e.class}: #{e.message}\n\t#{e.backtrace.join("\n\t")}"
+              # error reply can't be written into already started body
+              if request.reply_started?
+                request.send_reply_end rescue nil
+              else
+                request.send_error(500, nil) rescue nil
+              end
+            end
+          end
+        end
+      end
+      queue.method(:push)
+    end
+
+    attr_reader :workers
+
+    # Bind http instance on unix domain socket
+    # @param [String] path socket file path
+    # @param [Hash] options
+    # @option options [Fixnum] :mode socket file permissions (i.e 0660)
+    # @return [true false]
+    def bind_unix(path, options = {})
+      bind_unix_socket(path, options[:mode])
+    end
+
     # Set request handler for current http instance
     # @param block
     def handler(&block)
       set_request_handler(block)
     end
 
+    # Log completed requests to file.
+    # Records are written by background thread so logging does not block event loop.
+    # @param [String] path log file path
+    # @param [Hash] options
+    # @option options [Symbol] :format (:timed) :common, :timed or :json
+    # @option options [String] :reopen_signal ("HUP") signal to reopen log file on, nil to disable
+    # @return [AccessLog] log instance
+    def access_log(path, options = {})
+      log = AccessLog.new(path, options.fetch(:format, :timed))
+      set_access_log(log)
+      if signal = options.fetch(:reopen_signal, "HUP")
+        base.trap_signal(signal) { log.reopen }
+      end
+      log
+    end
+
+    private
+
+    # @return [Array<String>] IP addresses bind_socket listens on for address
+    def resolve_bind_address(address, port)
+      Addrinfo.getaddrinfo(address, port, nil, :STREAM, nil, Socket::AI_PASSIVE).map(&:ip_address)
+    rescue SocketError
+      [address]
+    end
+
   end
 end
@@ -1,4 +1,93 @@
+require "digest/sha1"
+
 module Libevent
   class HttpRequest
+    WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+    # Read-only Hash-like view of request input headers.
+    # Values are converted to Ruby strings only when accessed.
+    class Headers
+      include Enumerable
+
+      def initialize(request)
+        @request = request
+      end
+
+      # @param [String] name case insensitive header name
+      # @return [String nil]
+      def [](name)
+        @request.header(name)
+      end
+
+      # @param [String] name case insensitive header name
+      # @param [String] default value returned when header is missing
+      # @return [String]
+      def fetch(name, *default)
+        value = @request.header(name)
+        return value if value
+        return yield(name) if block_given?
+        return default.first unless default.empty?
+        raise KeyError, "header not found: #{name}"
+      end
+
+      # @param [String] name case insensitive header name
+      def key?(name)
+        !@request.header(name).nil?
+      end
+      alias_method :has_key?, :key?
+      alias_method :include?, :key?
+
+      # @yieldparam [String] name frozen header name
+      # @yieldparam [String] value
+      def each(&block)
+        return enum_for(:each) unless block
+        @request.each_header(&block)
+        self
+      end
+      alias_method :each_pair, :each
+
+      def keys
+        map { |name, _| name }
+      end
+
+      # @return [Hash]
+      def to_h
+        @request.get_input_headers
+      end
+      alias_method :to_hash, :to_h
+    end
+
+    # @return [Headers] lazy view of input headers
+    def headers
+      @headers ||= Headers.new(self)
+    end
+
+    # Switch connection to WebSocket protocol (RFC 6455).
+    # Replies with 400 and returns nil if request is not a valid upgrade request.
+    # Request object must not be used after successful upgrade.
+    # @param [Hash] options
+    # @option options [Array<String>] :protocols supported sub-protocols, first one requested by client is selected
+    # @option options [Fixnum] :max_message_size (16MB) connection is closed when client message is larger
+    # @yield [ws] set message handlers before any frame is processed
+    # @yieldparam [WebSocket] ws
+    # @return [WebSocket nil]
+    def upgrade_websocket(options = {})
+      key = header("Sec-WebSocket-Key")
+      unless get_command == "GET" && header("Upgrade").to_s.downcase == "websocket" &&
+             header("Connection").to_s.downcase.split(/\s*,\s*/).include?("upgrade") &&
+             header("Sec-WebSocket-Version") == "13" && key
+        send_error(400, "Bad Request")
+        return nil
+      end
+
+      requested = header("Sec-WebSocket-Protocol").to_s.split(/\s*,\s*/)
+      protocol = requested.find { |name| (options[:protocols] || []).include?(name) }
+
+      accept = [Digest::SHA1.digest(key + WEBSOCKET_GUID)].pack("m0")
+      ws = WebSocket.new(self, accept, protocol, options[:max_message_size] || 16 * 1024 * 1024)
+      ws.instance_variable_set(:@protocol, protocol)
+      yield ws if block_given?
+      ws
+    end
   end
 end
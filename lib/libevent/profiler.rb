@@ -0,0 +1,86 @@
+module Libevent
+  class Profiler
+    # Number of slow callbacks kept for #to_json and #flamegraph
+    MAX_SLOW = 100
+
+    # @return [Numeric] seconds, slower callbacks are logged
+    attr_reader :threshold
+
+    # @return [Fixnum] every Nth callback is profiled
+    attr_reader :sample
+
+    # @return [IO Logger nil] destination of slow callback reports
+    attr_accessor :log
+
+    # @return [Array<Hash>] recent slow callbacks
+    def slow
+      @slow ||= []
+    end
+
+    # Sample backtrace of loop thread while callback is running longer than threshold.
+    # Ruby switches threads at least every 100ms, so backtrace is sampled even if callback
+    # does not release GVL.
+    def start_watchdog
+      interval = [threshold / 2.0, 0.01].max
+      @watchdog = Thread.new do
+        sampled = nil
+        loop do
+          sleep interval
+          id, elapsed, thread = current
+          next if id.nil? || id == sampled || elapsed < threshold
+          sampled = id
+          store_backtrace(id, thread.backtrace)
+        end
+      end
+    end
+
+    # Stop profiling, collected stats are kept
+    def stop
+      detach
+      @watchdog.kill if @watchdog
+      @watchdog = nil
+    end
+
+    # Called from event loop when callback took longer than threshold
+    # @param [String] kind "http", "signal" or "websocket"
+    # @param [String] detail request URI, signal name or websocket event
+    # @param [Float] elapsed seconds
+    # @param [Array<String> nil] backtrace sampled while callback was running
+    def slow_callback(kind, detail, elapsed, backtrace)
+      slow << { "kind" => kind, "detail" => detail, "elapsed" => elapsed, "backtrace" => backtrace }
+      slow.shift if slow.size > MAX_SLOW
+      return unless log
+
+      message = "slow #{kind} callback #{'%.3f' % elapsed}s #{detail}"
+      message << "\n  " << backtrace.join("\n  ") if backtrace
+      log.respond_to?(:warn) ? log.warn(message) : log.puts(message)
+    end
+
+    # @return [String] stats with histograms and recent slow callbacks
+    def to_json(*args)
+      require "json"
+      stats.merge("threshold" => threshold, "slow" => slow).to_json(*args)
+    end
+
+    # Collapsed stacks for flamegraph.pl and compatible tools, values are microseconds.
+    # Callback totals are under "libevent", slow callbacks with sampled backtrace under "slow".
+    # @return [String]
+    def flamegraph
+      lines = stats["callbacks"].map do |callback|
+        "libevent;#{frame(callback['label'])} #{(callback['total'] * 1e6).round}"
+      end
+      slow.each do |callback|
+        next unless callback["backtrace"]
+        frames = [callback["kind"], callback["detail"]] + callback["backtrace"].reverse
+        lines << "slow;#{frames.map { |name| frame(name) }.join(';')} #{(callback['elapsed'] * 1e6).round}"
+      end
+      lines.map { |line| line + "\n" }.join
+    end
+
+    private
+
+    def frame(name)
+      name.tr(";\n", ": ")
+    end
+  end
+end
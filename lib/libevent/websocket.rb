@@ -0,0 +1,20 @@
+module Libevent
+  class WebSocket
+    # @return [String nil] selected sub-protocol
+    attr_reader :protocol
+
+    # Set handler called with every complete message
+    # @yieldparam [String] data message, UTF-8 for text messages
+    # @yieldparam [true false] binary true for binary message
+    def on_message(&block)
+      @on_message = block
+    end
+
+    # Set handler called once connection is closed
+    # @yieldparam [Fixnum] code close code, 1006 if connection is lost
+    # @yieldparam [String] reason
+    def on_close(&block)
+      @on_close = block
+    end
+  end
+end
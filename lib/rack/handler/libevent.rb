@@ -1,4 +1,6 @@
 require "libevent"
+require "rbconfig"
+require "shellwords"
 require "stringio"
 
 module Rack
@@ -12,7 +14,16 @@ module Rack
 
       def self.valid_options
         {
-          "timeout=TIMEOUT" => "Set the timeout for an HTTP request"
+          "timeout=TIMEOUT" => "Set the timeout for an HTTP request",
+          "access_log=PATH" => "Write access log to PATH",
+          "backlog=BACKLOG" => "Set listen queue length",
+          "reuseport" => "Set SO_REUSEPORT on listening socket",
+          "defer_accept" => "Set TCP_DEFER_ACCEPT on listening socket",
+          "fastopen[=QUEUE]" => "Enable TCP_FASTOPEN with given (default 256) queue length",
+          "nodelay" => "Set TCP_NODELAY on connections",
+          "threads=THREADS" => "Call application in pool of THREADS threads (default 0, call in event loop)",
+          "drain_timeout=SECONDS" => "Max time to finish in-flight requests on graceful stop (default 30)",
+          "restart_command=COMMAND" => "Command line started on SIGUSR2 (default rackup with current options)"
         }
       end
 
@@ -20,23 +31,47 @@ module Rack
         @app = app
         
         options[:Host] or raise ArgumentError, "Host option required"
-        options[:Port] or raise ArgumentError, "Port option required"
 
         @host = options[:Host]
-        @port = options[:Port].to_i
 
-        @base = ::Libevent::Base.new
+        if @host =~ /\Aunix:(.+)\z/
+          @socket_path = $1
+          @host = 'localhost'
+        else
+          options[:Port] or raise ArgumentError, "Port option required"
+        end
+
+        @port = options[:Port].to_i
+        @drain_timeout = (options[:drain_timeout] || 30).to_f
+        @threads = options[:threads].to_i
+
+        @listener_options = {}
+        @listener_options[:backlog]      = options[:backlog].to_i  if options[:backlog]
+        # bare -O fastopen gives true, bind_socket picks default queue length for it
+        @listener_options[:fastopen]     = options[:fastopen] == true ? true : options[:fastopen].to_i if options[:fastopen]
+        @listener_options[:reuseport]    = true if options[:reuseport]
+        @listener_options[:defer_accept] = true if options[:defer_accept]
+        @listener_options[:nodelay]      = true if options[:nodelay]
+
+        @base = ::Libevent::Base.new(:restart_command => restart_command(options))
         @http = ::Libevent::Http.new(@base)
 
         @http.set_timeout(options[:timeout].to_i) if options[:timeout]
+        @http.access_log(options[:access_log]) if options[:access_log]
       end
 
       def start
-        @http.bind_socket(@host, @port) or raise RuntimeError, "Can't bind to #{@host}:#{@port}"
-        @http.set_request_handler(self.method(:process))
+        if @socket_path
+          @http.inherit_socket(@socket_path) or @http.bind_unix(@socket_path) or raise RuntimeError, "Can't bind to unix:#{@socket_path}"
+        else
+          @http.inherit_socket(@host, @port) or @http.bind_socket(@host, @port, @listener_options) or raise RuntimeError, "Can't bind to #{@host}:#{@port}"
+        end
+        @http.set_request_handler(self.method(:process), :threads => @threads)
 
         @base.trap_signal("INT")  { self.stop }
         @base.trap_signal("TERM") { self.stop }
+        @base.trap_signal("QUIT") { @base.graceful_stop(@drain_timeout) }
+        @base.trap_signal("USR2") { @base.graceful_restart(@drain_timeout) }
 
         @base.dispatch
       end
@@ -47,6 +82,23 @@ module Rack
 
       protected
 
+      # Rackup parses ARGV before handler is loaded, so command line
+      # of restarted server is rebuilt from options
+      def restart_command(options)
+        return Shellwords.split(options[:restart_command]) if options[:restart_command]
+
+        command = [RbConfig.ruby, $0, "-s", "libevent", "-o", options[:Host]]
+        command.push("-p", options[:Port].to_s) if options[:Port]
+        command.push("-E", options[:environment]) if options[:environment]
+        self.class.valid_options.each_key do |option|
+          name = option[/\A\w+/].to_sym
+          next unless options[name]
+          command.push("-O", options[name] == true ? name.to_s : "#{name}=#{options[name]}")
+        end
+        command.push(options[:config]) if options[:config]
+        command
+      end
+
       def process(request)
         env = {}
 
@@ -65,11 +117,11 @@ module Rack
         env['rack.url_scheme']   = request.get_uri_scheme || 'http'
         env['rack.input']        = StringIO.new(request.get_body)
         env['rack.errors']       = STDERR
-        env['rack.multithread']  = false
+        env['rack.multithread']  = @threads > 0
         env['rack.multiprocess'] = false
         env['rack.run_once']     = false
 
-        request.get_input_headers.each do |key, val|
+        request.each_header do |key, val|
           env_key = ""
           env_key << "HTTP_" unless key =~ /^content(_|-)(type|length)$/i
           env_key << key